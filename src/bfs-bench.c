@@ -0,0 +1,337 @@
+/* bfs-bench.c -- runs every search engine of bfs-queue-ex.c over a map made by map-gen.c and reports how fast
+   they go. Build it with: gcc -std=c11 -O2 -pthread bfs-bench.c -o bfs-bench */
+
+// We want the engines and their statistics, but not the interactive main().
+#define SEARCH_STATS
+#define BFS_QUEUE_EX_NO_MAIN
+#include "bfs-queue-ex.c"
+
+#include <string.h>
+#include <stdint.h>
+
+#define BENCH_QUERIES 100 // Default amount of entrance/exit pairs.
+
+
+/* --- Usage: ---
+   bfs-bench <map file> [queries] [seed] [threads]
+   
+   Picks `queries` random pairs of open tiles that can reach each other, using `seed`, and runs all of them on
+   every engine. For each engine it prints the nodes expanded per second and the query latency percentiles.
+   Building the graph, the hierarchy and the search pool is done once, and reported apart. */
+
+
+// Per engine results.
+typedef struct bench_result {
+  const char * engine;
+  double * latencies;   // Seconds, one per query.
+  int query_count;
+  long expanded;
+  double wall_time;     // Sum of the latencies, or the whole batch for the pool.
+} BenchResult;
+
+
+// Map file loader.
+char * loadMap(const char * path, int * width, int * height);
+/* operation:          Reads a map-gen.c file into width * height glyphs, row by row.          */
+/* preconditions:      A path to a map file.                                                   */
+/* postconditions:     The malloc()ed map and its size, or 0 if the file is missing or broken. */
+/* additional info:    */
+
+// Restore the graph after runBreadthFirstSerach().
+void clearGraph(int width, int height, GNode * arr[][height], const char * map);
+/* operation:          Sets processed=false, track=0 and the map glyph on every node.                   */
+/* preconditions:      A graph built from map.                                                          */
+/* postconditions:     The graph as buildGraphFromMap() left it.                                        */
+/* additional info:    resetGraph() does the same, but it prints and paints walls over. Not timed here. */
+
+// Record one query.
+void addBenchSample(BenchResult *, const SearchStats *);
+/* operation:          Stores the query wall time as a latency and sums up its expanded nodes. */
+/* preconditions:      A BenchResult with room for one more latency.                          */
+/* postconditions:     One more query in the result.                                          */
+/* additional info:    */
+
+// Print one result line.
+void printBenchResult(const BenchResult *);
+/* operation:          Sorts the latencies and prints nodes/second, p50, p90, p99 and max in microseconds. */
+/* preconditions:      A BenchResult with at least one query.                                            */
+/* postconditions:     One line on stdout.                                                               */
+/* additional info:    */
+
+// Random number generator for picking pairs, same splitmix64 as map-gen.c.
+uint64_t nextBenchRandom(uint64_t * state);
+
+// Order doubles for qsort().
+int compareDoubles(const void *, const void *);
+
+// Seconds since some point in the past.
+double benchClock();
+
+
+/* --------------------------------------- MAIN --------------------------------------- */
+
+int main(int argc, char * argv[])
+{
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <map file> [queries] [seed] [threads]\n", argv[0]);
+    return 1;
+  }
+  
+  int width, height;
+  char * map = loadMap(argv[1], &width, &height);
+  if (map == 0) {
+    fprintf(stderr, "Could not read map %s\n", argv[1]);
+    return 1;
+  }
+  
+  int query_count = (argc > 2) ? atoi(argv[2]) : BENCH_QUERIES;
+  uint64_t seed = (argc > 3) ? strtoull(argv[3], 0, 10) : 1;
+  int thread_count = (argc > 4) ? atoi(argv[4]) : SEARCH_THREADS;
+  
+  // The node index is far too big for the stack on large maps.
+  GNode * (*arr)[height] = malloc((size_t)width * sizeof(*arr));
+  Graph graph;
+  Hierarchy hierarchy;
+  FlowField flow;
+  SearchContext ctx;
+  SearchPool pool;
+  SearchStats stats;
+  double started;
+  
+  printf("Map %s: %dx%d\n", argv[1], width, height);
+  
+  started = benchClock();
+  buildGraphFromMap(&graph, width, height, arr, map);
+  printf("  build graph:       %10.3f ms\n", (benchClock() - started) * 1e3);
+  
+  started = benchClock();
+  buildHierarchy(&hierarchy, CLUSTER_SIZE * 4, width, height, arr);
+  printf("  build hierarchy:   %10.3f ms (clusters of %dx%d)\n", (benchClock() - started) * 1e3, CLUSTER_SIZE * 4, CLUSTER_SIZE * 4);
+  
+  buildFlowField(&flow, width, height);
+  buildSearchContext(&ctx, width, height);
+  buildSearchPool(&pool, thread_count, width, height);
+  buildSearchStats(&stats);
+  graph.stats = hierarchy.stats = flow.stats = &stats;
+  
+  // Pick the pairs. The context search tells us which ones can reach each other.
+  PathQuery * queries = (PathQuery *)malloc(query_count * sizeof(PathQuery));
+  SearchStats * query_stats = (SearchStats *)malloc(query_count * sizeof(SearchStats));
+  int picked = 0;
+  for (int tries = 0; picked < query_count && tries < query_count * 100; tries++)
+  {
+    PathQuery * q = &queries[picked];
+    // One draw per statement. Two calls in the same expression may run in any order, and the pairs would not be
+    // the same for the same seed everywhere.
+    int ex = nextBenchRandom(&seed) % width;
+    int ey = nextBenchRandom(&seed) % height;
+    int fx = nextBenchRandom(&seed) % width;
+    int fy = nextBenchRandom(&seed) % height;
+    q->entrance = arr[ex][ey];
+    q->exit = arr[fx][fy];
+    q->path = 0;
+    q->stats = 0;
+    if (q->entrance->tile == '#' || q->exit->tile == '#' || q->entrance == q->exit) continue;
+    if (runContextSearch(&ctx, q)) picked++;
+  }
+  query_count = picked;
+  if (query_count == 0) {
+    fprintf(stderr, "No pair of tiles can reach each other on this map.\n");
+    return 1;
+  }
+  printf("  queries:           %10d\n\n", query_count);
+  printf("  %-14s %16s %12s %12s %12s %12s\n", "engine", "nodes/second", "p50 us", "p90 us", "p99 us", "max us");
+  
+  BenchResult result;
+  result.latencies = (double *)malloc(query_count * sizeof(double));
+  
+  // Plain Breadth-First Search.
+  result.engine = "bfs";
+  result.query_count = 0;
+  result.expanded = 0;
+  result.wall_time = 0;
+  for (int q = 0; q < query_count; q++)
+  {
+    graph.entrance = queries[q].entrance;
+    graph.exit = queries[q].exit;
+    runBreadthFirstSerach(&graph);
+    addBenchSample(&result, &stats);
+    clearGraph(width, height, arr, map);
+  }
+  printBenchResult(&result);
+  
+  // Hierarchical search. It clears its own scratch, only the tiles it paints need clearing, once checked.
+  int broken = 0;
+  result.engine = "hierarchical";
+  result.query_count = 0;
+  result.expanded = 0;
+  result.wall_time = 0;
+  for (int q = 0; q < query_count; q++)
+  {
+    graph.entrance = queries[q].entrance;
+    graph.exit = queries[q].exit;
+    runHierarchicalSearch(&hierarchy, width, height, arr, &graph);
+    addBenchSample(&result, &stats);
+    if (!checkMarkedPath(&graph)) broken++;
+    clearGraph(width, height, arr, map);
+  }
+  printBenchResult(&result);
+  if (broken > 0) printf("  (hierarchical marked %d broken paths)\n", broken);
+  
+  // Flow field. A whole field per query is the worst case for it, it pays off once many agents share the goal.
+  result.engine = "flow_field";
+  result.query_count = 0;
+  result.expanded = 0;
+  result.wall_time = 0;
+  for (int q = 0; q < query_count; q++)
+  {
+    started = benchClock();
+    runFlowField(&flow, &queries[q].exit, 1);
+    for (GNode * node = queries[q].entrance; node != 0; node = getFlowStep(&flow, node));
+    stats.wall_time = benchClock() - started;
+    addBenchSample(&result, &stats);
+  }
+  printBenchResult(&result);
+  
+  // Context search, one thread.
+  result.engine = "context";
+  result.query_count = 0;
+  result.expanded = 0;
+  result.wall_time = 0;
+  for (int q = 0; q < query_count; q++)
+  {
+    queries[q].stats = &stats;
+    runContextSearch(&ctx, &queries[q]);
+    addBenchSample(&result, &stats);
+  }
+  printBenchResult(&result);
+  
+  // Context search through the pool. Latencies are per query, nodes/second is for the whole batch.
+  result.engine = "pool";
+  result.query_count = 0;
+  result.expanded = 0;
+  for (int q = 0; q < query_count; q++)
+  {
+    buildSearchStats(&query_stats[q]);
+    queries[q].stats = &query_stats[q];
+  }
+  started = benchClock();
+  runSearchPool(&pool, queries, query_count);
+  double batch_time = benchClock() - started;
+  for (int q = 0; q < query_count; q++)
+  {
+    addBenchSample(&result, &query_stats[q]);
+    destroySearchStats(&query_stats[q]);
+  }
+  result.wall_time = batch_time;
+  printBenchResult(&result);
+  printf("  (pool used %d threads)\n", thread_count);
+  
+  destroySearchPool(&pool);
+  destroySearchContext(&ctx);
+  destroyFlowField(&flow);
+  destroyHierarchy(&hierarchy);
+  destroySearchStats(&stats);
+  free(result.latencies);
+  free(query_stats);
+  free(queries);
+  free(map);
+  // The nodes themselves go with the process, like everywhere else in bfs-queue-ex.c.
+  free(arr);
+  
+  return (broken > 0) ? 1 : 0;
+}
+
+
+
+/* ------------------------------------- FUNTIONS ------------------------------------- */
+
+// Map file loader.
+char * loadMap(const char * path, int * width, int * height)
+{
+  FILE * in = fopen(path, "r");
+  if (in == NULL) return 0;
+  
+  if (fscanf(in, "%d %d", width, height) != 2 || *width <= 0 || *height <= 0) {
+    fclose(in);
+    return 0;
+  }
+  
+  char * map = (char *)malloc((size_t)*width * *height);
+  int c = fgetc(in); // The new line after the size.
+  for (size_t i = 0; i < (size_t)*width * *height; )
+  {
+    c = fgetc(in);
+    if (c == EOF) {
+      free(map);
+      fclose(in);
+      return 0;
+    }
+    if (c != '\n' && c != '\r') map[i++] = c;
+  }
+  
+  fclose(in);
+  return map;
+}
+
+// Graph scratch reset.
+void clearGraph(int width, int height, GNode * arr[][height], const char * map)
+{
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      arr[x][y]->processed = false;
+      arr[x][y]->track = 0;
+      arr[x][y]->tile = (map[(size_t)y * width + x] == '#') ? '#' : 'O';
+    }
+  }
+}
+
+// Sample recording.
+void addBenchSample(BenchResult * r, const SearchStats * s)
+{
+  r->latencies[r->query_count++] = s->wall_time;
+  r->expanded += s->expanded;
+  r->wall_time += s->wall_time;
+}
+
+// Result line.
+void printBenchResult(const BenchResult * r)
+{
+  qsort(r->latencies, r->query_count, sizeof(double), compareDoubles);
+  
+  // Nearest rank percentiles.
+  int p50 = (r->query_count * 50 + 99) / 100 - 1;
+  int p90 = (r->query_count * 90 + 99) / 100 - 1;
+  int p99 = (r->query_count * 99 + 99) / 100 - 1;
+  
+  printf("  %-14s %16.0f %12.1f %12.1f %12.1f %12.1f\n", r->engine,
+         (r->wall_time > 0) ? r->expanded / r->wall_time : 0,
+         r->latencies[p50] * 1e6, r->latencies[p90] * 1e6, r->latencies[p99] * 1e6,
+         r->latencies[r->query_count - 1] * 1e6);
+}
+
+// splitmix64.
+uint64_t nextBenchRandom(uint64_t * state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// qsort() comparator.
+int compareDoubles(const void * a, const void * b)
+{
+  double da = *(const double *)a, db = *(const double *)b;
+  return (da > db) - (da < db);
+}
+
+// Wall clock.
+double benchClock()
+{
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <pthread.h> // Only for the search pool. Compile with -pthread.
+#ifdef SEARCH_STATS
+#include <time.h>
+#endif
 
 #define NEIGHBOR_MAX 4 // Maximun amount of neighbors for any given node.
 #define NEIGHBOR_TOP 0
@@ -11,15 +15,28 @@
 #define NEIGHBOR_BOT 2
 #define NEIGHBOR_LEFT 3
 
+// Layout of every per-tile array: flow fields, search contexts and the nodes made by buildGraphFromMap(). Row by
+// row by default. Compile with -DTILE_LAYOUT_MORTON to keep them in square blocks of TILE_BLOCK x TILE_BLOCK tiles
+// instead, Z-order (Morton) inside each block, so the tiles above and below are close in memory too. Add -mbmi2
+// (or -march=native) to interleave coordinates with pdep. getTileIndex() hides all of it.
+#ifdef TILE_LAYOUT_MORTON
+#define TILE_BLOCK_BITS 5
+#define TILE_BLOCK (1 << TILE_BLOCK_BITS)
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+#endif
+
 
 /* --- How to use a custom type on the queue: --- */
 
 // First define the custom struct to be used in the queue. Here is mine:
 typedef struct graph_node {
   char tile;
-  char x,y;
+  int x,y;
   struct graph_node * neighbors[NEIGHBOR_MAX];
   struct graph_node * track;
+  int portal; // Index in its cluster's portal list, or -1 when it is not a portal. See Hierarchy below.
   bool processed;  
 } GNode;
 
@@ -32,16 +49,146 @@ typedef struct graph_node {
 
 /* --- Now, the rest of the program. --- */
 
+// Search statistics. Compile with -DSEARCH_STATS to get them, otherwise every STATS_* below is nothing at all.
+// Each search engine takes a SearchStats pointer from its own struct (Graph, Hierarchy, FlowField, PathQuery),
+// so they stay per search and per thread. Leave the pointer at 0 to skip a single search. The hierarchical search
+// also counts the cluster rebuilds it does first, after switchPassable() calls.
+#ifdef SEARCH_STATS
+typedef struct search_stats {
+  const char * engine;
+  long expanded;        // Nodes taken out of the frontier, counting repeats.
+  long duplicates;      // Nodes put in the frontier while already in it.
+  long frontier_peak;
+  int path_length;      // Steps of the path found, -1 for none.
+  double wall_time;     // Seconds.
+  long * levels;        // Nodes expanded per Breadth-First Search level. Empty for engines without levels.
+  int level_count, level_capacity;
+  int level;            // Level bookkeeping: current level and how many frontier entries are left on it.
+  long level_left;
+  struct timespec started;
+} SearchStats;
+
+#define STATS_BEGIN(s, engine, sources) do { if ((s) != 0) beginSearchStats((s), (engine), (sources)); } while (0)
+#define STATS_EXPANDED(s, queued)       do { if ((s) != 0) countExpanded((s), (queued)); } while (0)
+#define STATS_NODE(s)                   do { if ((s) != 0) (s)->expanded++; } while (0)
+#define STATS_DUPLICATE(s)              do { if ((s) != 0) (s)->duplicates++; } while (0)
+#define STATS_FRONTIER(s, length)       do { if ((s) != 0 && (length) > (s)->frontier_peak) (s)->frontier_peak = (length); } while (0)
+#define STATS_END(s, path_length)       do { if ((s) != 0) endSearchStats((s), (path_length)); } while (0)
+#else
+#define STATS_BEGIN(s, engine, sources) do { } while (0)
+#define STATS_EXPANDED(s, queued)       do { } while (0)
+#define STATS_NODE(s)                   do { } while (0)
+#define STATS_DUPLICATE(s)              do { } while (0)
+#define STATS_FRONTIER(s, length)       do { } while (0)
+#define STATS_END(s, path_length)       do { } while (0)
+#endif
+
 // The grid graph and it's data. beginning is the first node of the graph, while entrance
 // and exit are for using with Breadth-First Search algorithm plus early exit.
 typedef struct graph {
   GNode * beginning;
   GNode * entrance;
   GNode * exit;
-  char width;
-  char height;
+  int width;
+  int height;
+#ifdef SEARCH_STATS
+  SearchStats * stats;  // For runBreadthFirstSerach().
+#endif
 } Graph;
 
+// Side of each square cluster used by main(). The demo grid is tiny, big maps want something like 16 to 64.
+#define CLUSTER_SIZE 4
+
+// A cluster is a square block of the grid. Its portals are the border nodes chosen as entrance points, one at
+// the middle of each run of open border, and dist holds the walking distance between every pair of portals
+// without ever leaving the cluster. cost, from and seen are scratch for the high-level search.
+typedef struct cluster {
+  GNode ** portals;  // Room for 4 * cluster_size portals, which is more than a border can ever give.
+  int * dist;        // portal_count * portal_count distances, -1 when unreachable inside the cluster.
+  int portal_count;
+  int * cost;        // Best cost found for each portal on the current query. Valid only if seen == query.
+  GNode ** from;     // Portal we reached each portal from, 0 when reached straight from the entrance.
+  unsigned * seen;
+  bool dirty;        // Marked by touchHierarchy(), cleared by rebuildCluster().
+} Cluster;
+
+// Heap entry for the high-level search over portals.
+typedef struct portal_step {
+  int cost;
+  GNode * node;
+} PortalStep;
+
+// The abstract graph laid over the grid. Clusters are stored row by row, columns * rows of them.
+typedef struct hierarchy {
+  Cluster * clusters;
+  int cluster_size;
+  int columns, rows;
+  int * dirty_list;  // Clusters waiting for a rebuild, so we never have to scan all of them.
+  int dirty_count;
+  unsigned query;    // Stamp of the current high-level search.
+  PortalStep * heap; // Binary min-heap by cost, kept between queries to avoid reallocating it.
+  int heap_length, heap_capacity;
+#ifdef SEARCH_STATS
+  SearchStats * stats;  // For runHierarchicalSearch(). Portals popped and cluster nodes walked both count as expanded.
+#endif
+} Hierarchy;
+
+// Flow field step values besides the NEIGHBOR_* directions.
+#define FLOW_GOAL NEIGHBOR_MAX        // The tile is a goal, stay there.
+#define FLOW_NONE (NEIGHBOR_MAX + 1)  // No goal can be reached from the tile.
+
+// Distance and next step towards the nearest goal for every tile, indexed by getTileIndex(). Built once
+// by runFlowField(), then any number of agents read their next move from it with getFlowStep().
+typedef struct flow_field {
+  int width, height;
+  int * dist;           // Steps to the nearest goal, -1 when unreachable.
+  unsigned char * step; // NEIGHBOR_* direction to walk, FLOW_GOAL or FLOW_NONE.
+#ifdef SEARCH_STATS
+  SearchStats * stats;  // For runFlowField().
+#endif
+} FlowField;
+
+// Threads used by main() for the search pool.
+#define SEARCH_THREADS 4
+
+// A path request and its answer. path is optional, give it room for length + 1 nodes to get the whole path.
+typedef struct path_query {
+  GNode * entrance;
+  GNode * exit;
+  int length;           // Out: steps from entrance to exit, -1 when there is no path.
+  GNode ** path;        // Out: nodes from entrance to exit, or 0 if you only want the length.
+  int path_capacity;
+#ifdef SEARCH_STATS
+  SearchStats * stats;  // For runContextSearch().
+#endif
+} PathQuery;
+
+// Everything a search writes, kept out of the nodes so many searches can share one graph. Tiles are indexed
+// by getTileIndex(). Make one per thread and reuse it, since allocating it is the expensive part.
+typedef struct search_context {
+  int width, height;
+  unsigned * seen;      // Tile was reached on the current search if seen == stamp. Saves clearing it every time.
+  unsigned stamp;
+  GNode ** parent;      // Node each tile was reached from.
+  GNode ** frontier;    // Every tile is queued at most once, so getTileCount() is all it ever needs.
+  struct search_pool * pool; // Pool this context works for, 0 when used by hand.
+} SearchContext;
+
+// A fixed set of threads, each with its own SearchContext, answering batches of PathQuery.
+typedef struct search_pool {
+  pthread_t * threads;
+  SearchContext * contexts;
+  int thread_count;
+  PathQuery * queries;  // Current batch.
+  int query_count;
+  int next_query;       // Next query to be taken by a thread.
+  int done_count;
+  bool stop;
+  pthread_mutex_t lock; // Guards everything above.
+  pthread_cond_t work;  // New batch or stop.
+  pthread_cond_t done;  // Batch finished.
+} SearchPool;
+
 // This one is not implemented yet. Skip it. Skip it now!
 Graph newGraph(int width, int height);
 /* operation:          */
@@ -63,6 +210,45 @@ void buildNewGraph(Graph *, int width, int height, GNode * arr[][height]);
 /*                     their's projected x,y position in the grid with functions. It may be more resource intensive  */
 /*                     but is less coding. Yeah, I know... did I already mentioned my laziness?                      */
 
+// Graph constructor for a ready made map.
+void buildGraphFromMap(Graph *, int width, int height, GNode * arr[][height], const char * map);
+/* operation:          Same as buildNewGraph(), but every node whose map char is '#' starts unpassable, exactly as  */
+/*                     if switchPassable() had been called on it. Nodes are linked straight through the array and  */
+/*                     live in a single block, placed by getTileIndex().                                           */
+/* preconditions:      A pointer to a uninitialized Graph and width * height map chars, row by row (y * width + x). */
+/* postconditions:     Leaves the Graph ready to use, with no debug output, so it is fine for huge maps.          */
+/* additional info:    Maps come from map-gen.c. Same memory leak warning as buildNewGraph().                     */
+
+// Tile position in the per-tile arrays.
+int getTileIndex(int width, int x, int y);
+/* operation:          Maps x,y to its index in a per-tile array of a grid width tiles wide.               */
+/* preconditions:      x,y inside the grid.                                                                */
+/* postconditions:     The index, always below getTileCount().                                             */
+/* additional info:    y * width + x, or the block and Morton code with TILE_LAYOUT_MORTON.                */
+
+// Size of the per-tile arrays.
+int getTileCount(int width, int height);
+/* operation:          Returns how many entries a per-tile array needs.                               */
+/* preconditions:      Nothing.                                                                       */
+/* postconditions:     width * height, or up to a block row and column more with TILE_LAYOUT_MORTON. */
+/* additional info:    The padding entries are never used, just allocated.                           */
+
+#ifdef TILE_LAYOUT_MORTON
+// Morton code of a position inside a block.
+unsigned mortonEncode(unsigned x, unsigned y);
+/* operation:          Interleaves the bits of x and y, x on the even bits.               */
+/* preconditions:      x,y below 65536.                                                   */
+/* postconditions:     The code.                                                          */
+/* additional info:    Two pdep with BMI2, a handful of shifts and masks without it.      */
+#endif
+
+// Set a node to blank.
+void clearNode(GNode *);
+/* operation:          Sets every field of the node to what newNode() gives. */
+/* preconditions:      A allocated GNode.                                   */
+/* postconditions:     A blank and linked to nothing node.                  */
+/* additional info:    For nodes that were not malloc()ed one by one.       */
+
 // Create a blank node.
 GNode * newNode();
 /* operation:          Creates a blank new node.                        */
@@ -156,9 +342,239 @@ void testLings(Graph *);
 // Run Breadth-First Search algorithm on the graph from it's entrance to it's exit.
 void runBreadthFirstSerach(Graph *);
 
+// Cluster hierarchy constructor.
+void buildHierarchy(Hierarchy *, int cluster_size, int width, int height, GNode * arr[][height]);
+/* operation:          Splits the grid in clusters of cluster_size x cluster_size nodes, picks their portals and    */
+/*                     precomputes the distances between the portals of each cluster.                               */
+/* preconditions:      A pointer to a uninitialized Hierarchy and a graph built by buildNewGraph().                 */
+/* postconditions:     A Hierarchy ready for runHierarchicalSearch().                                              */
+/* additional info:    Border clusters are smaller when width or height is not a multiple of cluster_size.          */
+
+// Cluster hierarchy destructor.
+void destroyHierarchy(Hierarchy *);
+/* operation:          Frees everything buildHierarchy() allocated.                               */
+/* preconditions:      A initialized Hierarchy whose graph nodes still exist.                       */
+/* postconditions:     The Hierarchy must be built again before use. Portal nodes get portal=-1 back. */
+/* additional info:    */
+
+// Tells the hierarchy a node changed.
+void touchHierarchy(Hierarchy *, int width, int height, int x, int y);
+/* operation:          Marks the cluster holding x,y as dirty, plus any cluster across the border from x,y. */
+/* preconditions:      A initialized Hierarchy. Call it after every switchPassable() on the graph.          */
+/* postconditions:     Touched clusters get rebuilt on the next refreshHierarchy().                         */
+/* additional info:    Cheap. Lots of switches in a row cost a single rebuild per cluster.                  */
+
+// Rebuild every dirty cluster.
+void refreshHierarchy(Hierarchy *, int width, int height, GNode * arr[][height]);
+/* operation:          Calls rebuildCluster() for each cluster marked by touchHierarchy(). */
+/* preconditions:      A initialized Hierarchy over the given graph.                      */
+/* postconditions:     No dirty clusters left.                                            */
+/* additional info:    runHierarchicalSearch() calls it by itself.                        */
+
+// Recompute portals and portal distances of a single cluster.
+void rebuildCluster(Hierarchy *, int width, int height, GNode * arr[][height], int cluster);
+/* operation:          Scans the four borders of the cluster for runs of nodes linked to the next cluster, */
+/*                     places a portal at the middle of each run and runs searchCluster() from each portal. */
+/* preconditions:      A initialized Hierarchy over the given graph.                                       */
+/* postconditions:     The cluster portals, node->portal indexes and dist matrix are up to date.           */
+/* additional info:    The cluster across a border computes the very same runs, so portals come in pairs.  */
+
+// Returns the index of the cluster holding the node.
+int getNodeCluster(const Hierarchy *, const GNode *);
+/* operation:          Maps node x,y to its cluster index. */
+/* preconditions:      A initialized Hierarchy.            */
+/* postconditions:     The cluster index.                  */
+/* additional info:    */
+
+// Breadth-First Search that never leaves a cluster.
+int searchCluster(Hierarchy *, int cluster, GNode * from, GNode * to, int * portal_dist);
+/* operation:          Runs a level by level Breadth-First Search from `from` restricted to the cluster,          */
+/*                     setting track on every node reached. If portal_dist is not 0, the level each portal is      */
+/*                     reached at is stored in portal_dist[node->portal] and the search covers the whole cluster.  */
+/* preconditions:      Both nodes inside the cluster, or to = 0. portal_dist must hold -1 for every portal.        */
+/* postconditions:     Returns the distance from `from` to `to`, or -1 when not reachable inside the cluster.      */
+/* additional info:    Leaves processed and track dirty. Call clearCluster() once you are done with them.          */
+
+// Restore processed and track of the nodes of a cluster.
+void clearCluster(Hierarchy *, int width, int height, GNode * arr[][height], int cluster);
+/* operation:          Sets processed=false and track=0 on every node of the cluster. */
+/* preconditions:      A initialized Hierarchy over the given graph.                  */
+/* postconditions:     The cluster is ready for another searchCluster().             */
+/* additional info:    */
+
+// Run the hierarchical search on the graph from it's entrance to it's exit.
+bool runHierarchicalSearch(Hierarchy *, int width, int height, GNode * arr[][height], Graph *);
+/* operation:          Finds the portal distances of the entrance and exit inside their own clusters, searches the  */
+/*                     abstract graph of portals for the cheapest route, then refines each cluster segment used by  */
+/*                     that route with searchCluster() and marks it just like runBreadthFirstSerach() does.         */
+/* preconditions:      A Hierarchy built over the graph and the graph's entrance and exit set.                      */
+/* postconditions:     Returns false when there is no path. Otherwise the path is marked with 'X' and 'F'.          */
+/* additional info:    Work depends on the number of portals, not nodes. Since portals sit at the middle of border */
+/*                     runs the path may be a few steps longer than the one runBreadthFirstSerach() gives.          */
+
+// Heap operations for the high-level search.
+void pushPortalStep(Hierarchy *, int cost, GNode * node);
+bool popPortalStep(Hierarchy *, PortalStep *);
+/* operation:          Push into and pop the cheapest step out of the hierarchy heap.  */
+/* preconditions:      A initialized Hierarchy.                                          */
+/* postconditions:     popPortalStep() returns false, leaving the step as is, when empty. */
+/* additional info:    */
+
+// Offer a new cost to a portal on the current high-level search.
+void relaxPortal(Hierarchy *, GNode * portal, int cost, GNode * from);
+/* operation:          Records cost and from for the portal and pushes it, if cost beats what it already has. */
+/* preconditions:      A portal node of the hierarchy.                                                        */
+/* postconditions:     The portal scratch is up to date for h->query.                                         */
+/* additional info:    */
+
+// Mark the path between two nodes of the same cluster.
+void markClusterPath(Hierarchy *, int width, int height, GNode * arr[][height], int cluster, GNode * from, GNode * to);
+/* operation:          Runs searchCluster() from `from` to `to` and marks the nodes walked with 'X'. */
+/* preconditions:      Both nodes inside the cluster.                                                */
+/* postconditions:     The segment is marked and the cluster cleared.                                */
+/* additional info:    */
+
+// Check a painted path.
+bool checkMarkedPath(Graph *);
+/* operation:          Walks from the entrance over linked 'X' tiles and tells if it reaches the exit ('F').    */
+/* preconditions:      A graph whose path was just marked, with processed=false everywhere.                  */
+/* postconditions:     true if the marked tiles connect S to F. processed is left false again.               */
+/* additional info:    For the benchmark and for catching holes in paths marked piece by piece.              */
+
+// Flow field constructor.
+void buildFlowField(FlowField *, int width, int height);
+/* operation:          Allocates the distance and step arrays for a width x height grid. */
+/* preconditions:      A pointer to a uninitialized FlowField.                          */
+/* postconditions:     A FlowField with every tile set to FLOW_NONE.                    */
+/* additional info:    One int and one char per tile.                                   */
+
+// Flow field destructor.
+void destroyFlowField(FlowField *);
+/* operation:          Frees everything buildFlowField() allocated. */
+/* preconditions:      A initialized FlowField.                     */
+/* postconditions:     It must be built again before use.           */
+/* additional info:    */
+
+// Fill the flow field from a set of goals.
+void runFlowField(FlowField *, GNode * goals[], int goal_count);
+/* operation:          Runs a single Breadth-First Search backwards from all goals at once, storing on each tile    */
+/*                     reached its distance to the nearest goal and the direction of the neighbor it was reached    */
+/*                     from, which is the first step of a shortest path.                                            */
+/* preconditions:      A FlowField built with the graph's width and height. goals holds goal_count nodes.           */
+/* postconditions:     Every tile holds its distance and step, or -1 and FLOW_NONE when no goal can be reached.     */
+/* additional info:    Replaces one runBreadthFirstSerach() per agent with one search for all of them. Does not     */
+/*                     touch the nodes, so it can run between searches without a resetGraph().                     */
+
+// Next move of an agent.
+GNode * getFlowStep(const FlowField *, const GNode * from);
+/* operation:          Looks up the step stored for the tile and returns the neighbor to move to. */
+/* preconditions:      A FlowField filled by runFlowField() on the graph holding `from`.          */
+/* postconditions:     The next node, or 0 when `from` is a goal or cannot reach one.             */
+/* additional info:    A single lookup, no searching.                                             */
+
+// Mark the path an agent at `from` would walk.
+bool followFlowField(const FlowField *, GNode * from);
+/* operation:          Walks getFlowStep() from `from` until a goal, marking the walk like runBreadthFirstSerach(). */
+/* preconditions:      A FlowField filled by runFlowField().                                                       */
+/* postconditions:     Returns false, marking nothing, when `from` cannot reach a goal.                            */
+/* additional info:    */
+
+// Flow field display.
+void printFlowField(const FlowField *);
+/* operation:          Prints the step of every tile as an arrow, G for goals and # for unreachable tiles. */
+/* preconditions:      A FlowField filled by runFlowField().                                               */
+/* postconditions:     A grid-like view of where every tile wants to go.                                   */
+/* additional info:    Looks even prettier than printVerticesAsGrid().                                     */
+
+// Search context constructor.
+void buildSearchContext(SearchContext *, int width, int height);
+/* operation:          Allocates the scratch arrays for searches on a width x height grid. */
+/* preconditions:      A pointer to a uninitialized SearchContext.                        */
+/* postconditions:     A SearchContext ready for runContextSearch().                      */
+/* additional info:    */
+
+// Search context destructor.
+void destroySearchContext(SearchContext *);
+/* operation:          Frees everything buildSearchContext() allocated. */
+/* preconditions:      A initialized SearchContext.                     */
+/* postconditions:     It must be built again before use.               */
+/* additional info:    */
+
+// Breadth-First Search that leaves the graph alone.
+bool runContextSearch(SearchContext *, PathQuery *);
+/* operation:          Runs Breadth-First Search from query->entrance to query->exit keeping visited, parent and  */
+/*                     frontier in the context, then fills query->length and, if asked, query->path.              */
+/* preconditions:      A SearchContext built with the graph's width and height.                                   */
+/* postconditions:     Returns false, with length -1, when there is no path. The graph is only read.              */
+/* additional info:    Any number of these can run at once on the same graph, each with its own context, as long  */
+/*                     as nobody calls switchPassable() or buildNewGraph() meanwhile.                             */
+
+// Search pool constructor.
+void buildSearchPool(SearchPool *, int thread_count, int width, int height);
+/* operation:          Starts thread_count threads, each with its own SearchContext, waiting for queries. */
+/* preconditions:      A pointer to a uninitialized SearchPool.                                           */
+/* postconditions:     A SearchPool ready for runSearchPool().                                            */
+/* additional info:    */
+
+// Search pool destructor.
+void destroySearchPool(SearchPool *);
+/* operation:          Stops and joins the threads, then frees everything buildSearchPool() allocated. */
+/* preconditions:      A initialized SearchPool with no batch running.                                 */
+/* postconditions:     It must be built again before use.                                              */
+/* additional info:    */
+
+// Answer a batch of queries in parallel.
+void runSearchPool(SearchPool *, PathQuery queries[], int query_count);
+/* operation:          Hands the queries to the pool threads, one at a time as each thread gets free. */
+/* preconditions:      A initialized SearchPool and a graph that stays still until it returns.        */
+/* postconditions:     Every query is answered. Blocks until then.                                    */
+/* additional info:    Call it again with the next batch to serve a stream of queries.                */
+
+// Body of every pool thread.
+void * searchPoolWorker(void * context);
+/* operation:          Takes queries from the current batch and answers them with its context, forever. */
+/* preconditions:      Started by buildSearchPool() with a SearchContext of the pool.                   */
+/* postconditions:     Returns when the pool is destroyed.                                              */
+/* additional info:    */
+
+#ifdef SEARCH_STATS
+// Search statistics constructor and destructor.
+void buildSearchStats(SearchStats *);
+void destroySearchStats(SearchStats *);
+/* operation:          Zeroes everything, or frees the level counts.                       */
+/* preconditions:      A pointer to a uninitialized SearchStats, or a initialized one.     */
+/* postconditions:     A SearchStats ready to be pointed at by a engine, or a freed one.   */
+/* additional info:    One SearchStats can be reused for any number of searches.          */
+
+// Start and finish a search.
+void beginSearchStats(SearchStats *, const char * engine, long sources);
+void endSearchStats(SearchStats *, int path_length);
+/* operation:          Resets the counters and starts the clock, or stops it and stores the path length. */
+/* preconditions:      A initialized SearchStats. sources is how many nodes the search starts from.      */
+/* postconditions:     The counters hold the last search only.                                           */
+/* additional info:    Called by the engines through STATS_BEGIN and STATS_END.                          */
+
+// Count a node expansion of a Breadth-First Search.
+void countExpanded(SearchStats *, long queued);
+/* operation:          Counts the node on the current level, updates the frontier peak with queued and moves  */
+/*                     to the next level once every node queued for this one is expanded.                    */
+/* preconditions:      queued is the frontier length after the node's neighbors were added.                   */
+/* postconditions:     Counters updated.                                                                      */
+/* additional info:    Works for any FIFO frontier, even one holding duplicates, since levels never mix in it. */
+
+// Write the statistics as a JSON line.
+void printSearchStats(FILE *, const SearchStats *);
+/* operation:          Prints one JSON object with every counter, followed by a new line. */
+/* preconditions:      A SearchStats filled by a search.                                  */
+/* postconditions:     A line ready to be appended to a .jsonl file.                      */
+/* additional info:    */
+#endif
+
 
 /* --------------------------------------- MAIN --------------------------------------- */
 
+// bfs-bench.c includes this whole file to reuse the search engines and brings its own main(), so it hides ours.
+#ifndef BFS_QUEUE_EX_NO_MAIN
 int main(void)
 {
   printf("\n--- BREADTH-FIRST SEARCH - LCF IMPLEMENTATION ---\n");
@@ -170,6 +586,15 @@ int main(void)
   // Display array, for being printed.
   GNode * displayArr[graph_width][graph_height];
   Graph graph_main;
+  Hierarchy hierarchy_main;
+  bool hierarchy_built = false;
+  FlowField flow_main;
+  SearchPool pool_main;
+#ifdef SEARCH_STATS
+  // Every search writes its statistics as a JSON line on stderr. Keep them with: ./a.out 2> stats.jsonl
+  SearchStats stats_main;
+  buildSearchStats(&stats_main);
+#endif
   
   // Control variables.
   char input;
@@ -195,7 +620,15 @@ int main(void)
     if (input == '1') {
       printf("\nSELECTED %c\n", input);
       printf(" Building new graph...\n");
+      // The old hierarchy points to the old nodes, so it has to go.
+      if (hierarchy_built) {
+        destroyHierarchy(&hierarchy_main);
+        hierarchy_built = false;
+      }
       buildNewGraph(&graph_main, graph_width, graph_height, &displayArr);
+#ifdef SEARCH_STATS
+      graph_main.stats = &stats_main;
+#endif
       printf("\nDone.\n");
       continue;
     }
@@ -216,6 +649,7 @@ int main(void)
       scanf("%d %d", &node_x, &node_y);
       clearInput();
       switchPassable(graph_width, graph_height, &displayArr, node_x, node_y);
+      if (hierarchy_built) touchHierarchy(&hierarchy_main, graph_width, graph_height, node_x, node_y);
       //switchPassable(getNodeAt(node_x, node_y), node_glyph); // Future update
       printf(" Node at (%d,%d) switched.\n", node_x, node_y);
       continue;
@@ -240,19 +674,122 @@ int main(void)
       printf(" Executing Breadth-First Search from graph's entrance to graph's exit:\n\n");
       runBreadthFirstSerach(&graph_main);
       printf(" Breadth-First Search completed.\n");
+#ifdef SEARCH_STATS
+      printSearchStats(stderr, &stats_main);
+#endif
       printVerticesAsGrid(graph_width, graph_height, &displayArr);
       resetGraph(graph_width, graph_height, &displayArr, &graph_main);
       continue;
     }
     
+    // Hierarchical search. The hierarchy is built on first use and kept up to date by option 3 afterwards.
+    if (input == '6') {
+      printf("\nSELECTED %c\n", input);
+      if (!hierarchy_built) {
+        printf(" Building cluster hierarchy... ");
+        buildHierarchy(&hierarchy_main, CLUSTER_SIZE, graph_width, graph_height, displayArr);
+        hierarchy_built = true;
+#ifdef SEARCH_STATS
+        hierarchy_main.stats = &stats_main;
+#endif
+        printf("done. %d clusters.\n", hierarchy_main.columns * hierarchy_main.rows);
+      }
+      printf(" Executing Hierarchical Search from graph's entrance to graph's exit:\n\n");
+      if (runHierarchicalSearch(&hierarchy_main, graph_width, graph_height, displayArr, &graph_main))
+        printf(" Hierarchical Search completed%s.\n", checkMarkedPath(&graph_main) ? "" : ", but the marked path is broken");
+      else
+        printf(" Hierarchical Search found no path.\n");
+#ifdef SEARCH_STATS
+      printSearchStats(stderr, &stats_main);
+#endif
+      printVerticesAsGrid(graph_width, graph_height, displayArr);
+      resetGraph(graph_width, graph_height, displayArr, &graph_main);
+      continue;
+    }
+    
+    // Flow field. One search towards the exit serves every agent, here we walk a single one from the entrance.
+    if (input == '7') {
+      printf("\nSELECTED %c\n", input);
+      printf(" Building flow field towards graph's exit:\n\n");
+      buildFlowField(&flow_main, graph_width, graph_height);
+#ifdef SEARCH_STATS
+      flow_main.stats = &stats_main;
+#endif
+      runFlowField(&flow_main, &graph_main.exit, 1);
+#ifdef SEARCH_STATS
+      printSearchStats(stderr, &stats_main);
+#endif
+      printFlowField(&flow_main);
+      if (followFlowField(&flow_main, graph_main.entrance))
+        printf(" Walked from graph's entrance following the flow field.\n");
+      else
+        printf(" Graph's entrance cannot reach the exit.\n");
+      destroyFlowField(&flow_main);
+      printVerticesAsGrid(graph_width, graph_height, displayArr);
+      resetGraph(graph_width, graph_height, displayArr, &graph_main);
+      continue;
+    }
+    
+    // Concurrent searches. Every node asks for its path to the exit, all at once, through the search pool.
+    if (input == '8') {
+      printf("\nSELECTED %c\n", input);
+      printf(" Running %d searches towards graph's exit on %d threads... ", graph_width * graph_height, SEARCH_THREADS);
+      PathQuery queries[graph_width * graph_height];
+      GNode * path[graph_width * graph_height];
+      int found = 0;
+      for (int q = 0; q < graph_width * graph_height; q++)
+      {
+        queries[q].entrance = displayArr[q % graph_width][q / graph_width];
+        queries[q].exit = graph_main.exit;
+        queries[q].path = 0;
+      }
+#ifdef SEARCH_STATS
+      // One SearchStats per query, since they run at the same time.
+      SearchStats query_stats[graph_width * graph_height];
+      for (int q = 0; q < graph_width * graph_height; q++)
+      {
+        buildSearchStats(&query_stats[q]);
+        queries[q].stats = &query_stats[q];
+      }
+#endif
+      // We also want the entrance path itself, to show it.
+      queries[0].entrance = graph_main.entrance;
+      queries[0].path = path;
+      queries[0].path_capacity = graph_width * graph_height;
+      buildSearchPool(&pool_main, SEARCH_THREADS, graph_width, graph_height);
+      runSearchPool(&pool_main, queries, graph_width * graph_height);
+      destroySearchPool(&pool_main);
+      for (int q = 0; q < graph_width * graph_height; q++)
+      {
+        if (queries[q].length >= 0) found++;
+#ifdef SEARCH_STATS
+        printSearchStats(stderr, &query_stats[q]);
+        destroySearchStats(&query_stats[q]);
+#endif
+      }
+      printf("done. %d of them found a path.\n", found);
+      if (queries[0].length >= 0) {
+        for (int i = 1; i < queries[0].length; i++) path[i]->tile = 'X';
+        path[queries[0].length]->tile = 'F';
+      }
+      printVerticesAsGrid(graph_width, graph_height, displayArr);
+      resetGraph(graph_width, graph_height, displayArr, &graph_main);
+      continue;
+    }
+    
     // If no valid option was selected, we finish the program.
     break;
   }
   
   printf("\n Bye.\n\n");
   
+#ifdef SEARCH_STATS
+  destroySearchStats(&stats_main);
+#endif
+  
   return 0;
 }
+#endif
 
 
 
@@ -267,6 +804,9 @@ void printOptions()
   printf("  3 - Switch a node at x,y to be passable or not.\n");
   printf("  4 - Set graph entrance and exit. They will be marked with S and E, respectively.\n");
   printf("  5 - Run Breadth-First Search algorithm on the graph. Requires steps 1 and 4 performed.\n");
+  printf("  6 - Run Hierarchical Search over clusters of %dx%d nodes. Requires steps 1 and 4 performed.\n", CLUSTER_SIZE, CLUSTER_SIZE);
+  printf("  7 - Build a flow field towards the exit and walk it from the entrance. Requires steps 1 and 4 performed.\n");
+  printf("  8 - Search from every node to the exit at once with %d threads. Requires steps 1 and 4 performed.\n", SEARCH_THREADS);
   printf("  Type anything else to exit.\n\n");
 }
 
@@ -341,6 +881,8 @@ void runBreadthFirstSerach(Graph * g)
   enqueue(frontier, g->entrance);
   GNode * exit = g->exit;
   GNode * explorer = 0;
+  int steps = 0;
+  STATS_BEGIN(g->stats, "bfs", 1);
   while (explorer != exit)
   {
     // Gets next on queue
@@ -350,15 +892,20 @@ void runBreadthFirstSerach(Graph * g)
     explorer->processed = true;
     
     // Cycle through all neighbors and, for each, check if is a valid existent node and if
-    // has not been processed yet, adding it to the frontier if so.
+    // has not been processed nor reached yet, adding it to the frontier if so. A node already reached is
+    // already in the frontier. Queueing it again would expand it once per copy, and on open maps the copies
+    // pile up exponentially. It would also move its track to a node farther from the entrance.
     for (int n = 0; n < NEIGHBOR_MAX; n++){
-      if (explorer->neighbors[n] != NULL && explorer->neighbors[n] != 0 && explorer->neighbors[n]->processed == false) {
+      if (explorer->neighbors[n] != NULL && explorer->neighbors[n] != 0 && explorer->neighbors[n]->processed == false
+          && explorer->neighbors[n]->track == 0) {
         // Sets track to point to the node which we reached explorer->neighbors[n] from.
         explorer->neighbors[n]->track = explorer;
         // Adds explorer->neighbors[n] to the frontier.
         enqueue(frontier, explorer->neighbors[n]);
       }
     }
+    
+    STATS_EXPANDED(g->stats, frontier->length);
   }
   
   // explorer is on the exit, so lets mark it as F for Final. I like the word Final. Like in Final Destination or something alike.
@@ -370,11 +917,18 @@ void runBreadthFirstSerach(Graph * g)
   {
     explorer = explorer->track;
     explorer->tile = 'X';
+    steps++;
   }
   
+  STATS_END(g->stats, steps);
+  
   // Now place the 'S' back on it's place
   explorer->tile = 'S';
   
+  // Whatever is still in the frontier was never needed. dequeue() frees its QElem.
+  while (!isQueueEmpty(frontier)) dequeue(frontier);
+  free(frontier);
+  
   /* Nooot working.
   // Theoretically, we should be done by now. Let's just reset all nodes' track and processed now.
   explorer = g->beginning; // Should be at top-left of the graph.
@@ -497,13 +1051,20 @@ Graph newGraph(int width, int height)
 GNode * newNode()
 {
   GNode * n = (GNode *)malloc(sizeof(GNode));
+  clearNode(n);
+  return n;
+}
+
+// Node reset.
+void clearNode(GNode * n)
+{
   n->processed = false;
   n->track = 0;
+  n->portal = -1;
   for (int i = 0; i < NEIGHBOR_MAX; i++){
     n->neighbors[i] = 0;
   }
   n->tile = 'O';
-  return n;
 }
 
 // Create a node and set it's x and y. Return it's address.
@@ -529,6 +1090,9 @@ void buildNewGraph(Graph * g, int width, int height, GNode * arr[][height]) // T
   g->height = height;
   g->entrance = 0;
   g->exit = 0;
+#ifdef SEARCH_STATS
+  g->stats = 0;
+#endif
   
   Queue * queue_prev_row = newQueue();
   Queue * queue_curr_row = newQueue();
@@ -545,7 +1109,7 @@ void buildNewGraph(Graph * g, int width, int height, GNode * arr[][height]) // T
     for (int x = 0; x < width; x++)
     {
       // Debug
-      printf("   C.%d | START === | Qp->l:%d | Qc->l:%d | PUSH ==>", x, queue_prev_row->length, queue_curr_row->length);
+      printf("   C.%d | START === | Qp->l:%lld | Qc->l:%lld | PUSH ==>", x, queue_prev_row->length, queue_curr_row->length);
       
       // New GNode.
       node_curr = newNodeAt(x,y);
@@ -555,7 +1119,7 @@ void buildNewGraph(Graph * g, int width, int height, GNode * arr[][height]) // T
       enqueue(queue_curr_row, node_curr);
       
       // Debug
-      printf(" | Qp->l:%d | Qc->l:%d | POP ==>", queue_prev_row->length, queue_curr_row->length);
+      printf(" | Qp->l:%lld | Qc->l:%lld | POP ==>", queue_prev_row->length, queue_curr_row->length);
       
       // If we are not at the first row, create edges to and from current node's top neighbor.
       if (y > 0) // There is nothing to dequeue at first row.
@@ -574,19 +1138,17 @@ void buildNewGraph(Graph * g, int width, int height, GNode * arr[][height]) // T
       }
       
       // Debug
-      printf(" | Qp->l:%d | Qc->l:%d |\n", queue_prev_row->length, queue_curr_row->length);
+      printf(" | Qp->l:%lld | Qc->l:%lld |\n", queue_prev_row->length, queue_curr_row->length);
       
       arr[x][y] = node_curr;
     }
     
-    // Each X loop end, we still need to pop X3 and link X4->X3 and X3->X4.
-    // Since we are still to set the new node_curr... :P
-    node_neigh = dequeue(queue_curr_row); // This is the left neighbor to the current node.
-    setNodeNeighbor(node_curr, NEIGHBOR_LEFT, node_neigh); // Link edge node_curr->node_neigh.
-    setNodeNeighbor(node_neigh, NEIGHBOR_RIGHT, node_curr); // Link edge node_neigh->node_curr.
+    // Each X loop end, the last node of the row is still queued. It was already linked to its left neighbor
+    // inside the loop, so we just pop it. Linking it again here would link it to itself.
+    dequeue(queue_curr_row);
     
-    printf(" Final queue_prev_row->length %d\n",queue_prev_row->length);
-    printf(" Final queue_curr_row->length %d\n",queue_curr_row->length);
+    printf(" Final queue_prev_row->length %lld\n",queue_prev_row->length);
+    printf(" Final queue_curr_row->length %lld\n",queue_curr_row->length);
   }
   
   // Free allocated memory.
@@ -601,22 +1163,889 @@ void buildNewGraph(Graph * g, int width, int height, GNode * arr[][height]) // T
 }
 
 
+// Cluster hierarchy constructor.
+void buildHierarchy(Hierarchy * h, int cluster_size, int width, int height, GNode * arr[][height])
+{
+  h->cluster_size = cluster_size;
+  h->columns = (width + cluster_size - 1) / cluster_size;
+  h->rows = (height + cluster_size - 1) / cluster_size;
+  h->clusters = (Cluster *)malloc(h->columns * h->rows * sizeof(Cluster));
+  h->dirty_list = (int *)malloc(h->columns * h->rows * sizeof(int));
+  h->dirty_count = 0;
+  h->query = 0;
+  h->heap = 0;
+  h->heap_length = h->heap_capacity = 0;
+#ifdef SEARCH_STATS
+  h->stats = 0;
+#endif
+  
+  for (int c = 0; c < h->columns * h->rows; c++)
+  {
+    Cluster * cl = &h->clusters[c];
+    cl->portals = (GNode **)malloc(4 * cluster_size * sizeof(GNode *));
+    cl->dist = 0;
+    cl->portal_count = 0;
+    cl->cost = (int *)malloc(4 * cluster_size * sizeof(int));
+    cl->from = (GNode **)malloc(4 * cluster_size * sizeof(GNode *));
+    cl->seen = (unsigned *)calloc(4 * cluster_size, sizeof(unsigned));
+    // Everything starts dirty, so the first refresh is the full precomputation.
+    cl->dirty = true;
+    h->dirty_list[h->dirty_count++] = c;
+  }
+  
+  refreshHierarchy(h, width, height, arr);
+}
+
+// Cluster hierarchy destructor.
+void destroyHierarchy(Hierarchy * h)
+{
+  for (int c = 0; c < h->columns * h->rows; c++)
+  {
+    // Nodes outlive us, so they must not keep pointing into our portal lists.
+    for (int i = 0; i < h->clusters[c].portal_count; i++) h->clusters[c].portals[i]->portal = -1;
+    free(h->clusters[c].portals);
+    free(h->clusters[c].dist);
+    free(h->clusters[c].cost);
+    free(h->clusters[c].from);
+    free(h->clusters[c].seen);
+  }
+  free(h->clusters);
+  free(h->dirty_list);
+  free(h->heap);
+  h->clusters = 0;
+  h->dirty_list = 0;
+  h->heap = 0;
+}
+
+// Cluster lookup.
+int getNodeCluster(const Hierarchy * h, const GNode * node)
+{
+  return (node->y / h->cluster_size) * h->columns + node->x / h->cluster_size;
+}
+
+// Dirty marking.
+void touchHierarchy(Hierarchy * h, int width, int height, int x, int y)
+{
+  // Offsets of the top, right, bottom and left neighbors, in the NEIGHBOR_* order.
+  int dx[NEIGHBOR_MAX] = {0, 1, 0, -1};
+  int dy[NEIGHBOR_MAX] = {-1, 0, 1, 0};
+  int c;
+  
+  // The node's own cluster always changes. A node on the border also changes the runs, and so the
+  // portals, of the cluster across it. We check it by position because the links may be broken now.
+  for (int n = -1; n < NEIGHBOR_MAX; n++)
+  {
+    int nx = (n < 0) ? x : x + dx[n];
+    int ny = (n < 0) ? y : y + dy[n];
+    if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+    c = (ny / h->cluster_size) * h->columns + nx / h->cluster_size;
+    if (h->clusters[c].dirty == false) {
+      h->clusters[c].dirty = true;
+      h->dirty_list[h->dirty_count++] = c;
+    }
+  }
+}
+
+// Dirty clusters rebuild.
+void refreshHierarchy(Hierarchy * h, int width, int height, GNode * arr[][height])
+{
+  while (h->dirty_count > 0)
+  {
+    h->dirty_count--;
+    rebuildCluster(h, width, height, arr, h->dirty_list[h->dirty_count]);
+  }
+}
+
+// Single cluster rebuild.
+void rebuildCluster(Hierarchy * h, int width, int height, GNode * arr[][height], int cluster)
+{
+  Cluster * cl = &h->clusters[cluster];
+  int x0 = (cluster % h->columns) * h->cluster_size;
+  int y0 = (cluster / h->columns) * h->cluster_size;
+  int x1 = (x0 + h->cluster_size < width) ? x0 + h->cluster_size - 1 : width - 1;
+  int y1 = (y0 + h->cluster_size < height) ? y0 + h->cluster_size - 1 : height - 1;
+  GNode * node;
+  
+  // Forget the old portals.
+  for (int i = 0; i < cl->portal_count; i++) cl->portals[i]->portal = -1;
+  cl->portal_count = 0;
+  
+  // Walk each border in the NEIGHBOR_* order. A border node is open when it and its neighbor across the
+  // border point at each other, which also rules out nodes walled by switchPassable().
+  for (int n = 0; n < NEIGHBOR_MAX; n++)
+  {
+    bool along_x = (n == NEIGHBOR_TOP || n == NEIGHBOR_BOT);
+    int length = along_x ? x1 - x0 + 1 : y1 - y0 + 1;
+    int run_start = -1;
+    
+    for (int i = 0; i <= length; i++)
+    {
+      bool open = false;
+      if (i < length) {
+        if (n == NEIGHBOR_TOP) node = arr[x0 + i][y0];
+        else if (n == NEIGHBOR_BOT) node = arr[x0 + i][y1];
+        else if (n == NEIGHBOR_LEFT) node = arr[x0][y0 + i];
+        else node = arr[x1][y0 + i];
+        open = node->neighbors[n] != 0 && node->neighbors[n]->neighbors[(n + 2) % NEIGHBOR_MAX] == node;
+      }
+      
+      if (open && run_start < 0) run_start = i;
+      
+      // Run just ended, its middle node becomes a portal. A corner may already be one from the other border.
+      if (!open && run_start >= 0) {
+        int mid = (run_start + i - 1) / 2;
+        node = along_x ? arr[x0 + mid][(n == NEIGHBOR_TOP) ? y0 : y1] : arr[(n == NEIGHBOR_LEFT) ? x0 : x1][y0 + mid];
+        if (node->portal < 0) {
+          node->portal = cl->portal_count;
+          cl->portals[cl->portal_count++] = node;
+        }
+        run_start = -1;
+      }
+    }
+  }
+  
+  // Now the distances, one cluster-wide search per portal.
+  free(cl->dist);
+  cl->dist = (int *)malloc((cl->portal_count * cl->portal_count + 1) * sizeof(int));
+  for (int i = 0; i < cl->portal_count; i++)
+  {
+    for (int j = 0; j < cl->portal_count; j++) cl->dist[i * cl->portal_count + j] = -1;
+    searchCluster(h, cluster, cl->portals[i], 0, &cl->dist[i * cl->portal_count]);
+    clearCluster(h, width, height, arr, cluster);
+  }
+  
+  cl->dirty = false;
+}
+
+// Cluster restricted Breadth-First Search.
+int searchCluster(Hierarchy * h, int cluster, GNode * from, GNode * to, int * portal_dist)
+{
+  // Two queues, one for the level being expanded and one for the next, so we always know the distance.
+  Queue * level_curr = newQueue();
+  Queue * level_next = newQueue();
+  Queue * level_swap;
+  GNode * explorer;
+  GNode * neigh;
+  int level = 0;
+  int found = -1;
+  bool done = false;
+  
+  from->processed = true;
+  from->track = 0;
+  enqueue(level_curr, from);
+  
+  while (!done && !isQueueEmpty(level_curr))
+  {
+    while (!done && !isQueueEmpty(level_curr))
+    {
+      explorer = dequeue(level_curr);
+      STATS_NODE(h->stats);
+      
+      if (portal_dist != 0 && explorer->portal >= 0) portal_dist[explorer->portal] = level;
+      
+      // Early exit only if nobody wants the portal distances.
+      if (explorer == to) {
+        found = level;
+        if (portal_dist == 0) done = true;
+      }
+      
+      // Marking on enqueue keeps each node in the queues once, so levels are exact.
+      for (int n = 0; n < NEIGHBOR_MAX; n++){
+        neigh = explorer->neighbors[n];
+        if (neigh != 0 && neigh->processed == false && getNodeCluster(h, neigh) == cluster) {
+          neigh->processed = true;
+          neigh->track = explorer;
+          enqueue(level_next, neigh);
+        }
+      }
+    }
+    
+    level_swap = level_curr;
+    level_curr = level_next;
+    level_next = level_swap;
+    level++;
+  }
+  
+  // On early exit there may be leftovers. dequeue() frees their QElem.
+  while (!isQueueEmpty(level_curr)) dequeue(level_curr);
+  while (!isQueueEmpty(level_next)) dequeue(level_next);
+  free(level_curr);
+  free(level_next);
+  
+  return found;
+}
+
+// Cluster scratch reset.
+void clearCluster(Hierarchy * h, int width, int height, GNode * arr[][height], int cluster)
+{
+  int x0 = (cluster % h->columns) * h->cluster_size;
+  int y0 = (cluster / h->columns) * h->cluster_size;
+  
+  for (int y = y0; y < y0 + h->cluster_size && y < height; y++)
+  {
+    for (int x = x0; x < x0 + h->cluster_size && x < width; x++)
+    {
+      arr[x][y]->processed = false;
+      arr[x][y]->track = 0;
+    }
+  }
+}
+
+// Heap push.
+void pushPortalStep(Hierarchy * h, int cost, GNode * node)
+{
+  if (h->heap_length == h->heap_capacity) {
+    h->heap_capacity = (h->heap_capacity == 0) ? 64 : h->heap_capacity * 2;
+    h->heap = (PortalStep *)realloc(h->heap, h->heap_capacity * sizeof(PortalStep));
+  }
+  
+  // Sift up.
+  int i = h->heap_length++;
+  while (i > 0 && h->heap[(i - 1) / 2].cost > cost)
+  {
+    h->heap[i] = h->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  h->heap[i].cost = cost;
+  h->heap[i].node = node;
+}
+
+// Heap pop.
+bool popPortalStep(Hierarchy * h, PortalStep * step)
+{
+  if (h->heap_length == 0) return false;
+  
+  *step = h->heap[0];
+  PortalStep last = h->heap[--h->heap_length];
+  
+  // Sift the last element down from the root.
+  int i = 0;
+  while (2 * i + 1 < h->heap_length)
+  {
+    int child = 2 * i + 1;
+    if (child + 1 < h->heap_length && h->heap[child + 1].cost < h->heap[child].cost) child++;
+    if (last.cost <= h->heap[child].cost) break;
+    h->heap[i] = h->heap[child];
+    i = child;
+  }
+  h->heap[i] = last;
+  
+  return true;
+}
+
+// Portal relaxation.
+void relaxPortal(Hierarchy * h, GNode * portal, int cost, GNode * from)
+{
+  Cluster * cl = &h->clusters[getNodeCluster(h, portal)];
+  int i = portal->portal;
+  
+  if (cl->seen[i] != h->query || cost < cl->cost[i]) {
+    // Already pushed on this query, so this push makes a stale copy.
+    if (cl->seen[i] == h->query) STATS_DUPLICATE(h->stats);
+    cl->seen[i] = h->query;
+    cl->cost[i] = cost;
+    cl->from[i] = from;
+    pushPortalStep(h, cost, portal);
+    STATS_FRONTIER(h->stats, h->heap_length);
+  }
+}
+
+// Cluster segment marking.
+void markClusterPath(Hierarchy * h, int width, int height, GNode * arr[][height], int cluster, GNode * from, GNode * to)
+{
+  GNode * explorer = to;
+  
+  if (searchCluster(h, cluster, from, to, 0) >= 0) {
+    while (explorer != 0)
+    {
+      explorer->tile = 'X';
+      explorer = explorer->track;
+    }
+  }
+  
+  clearCluster(h, width, height, arr, cluster);
+}
+
+// Painted path check.
+bool checkMarkedPath(Graph * g)
+{
+  GNode ** seen = (GNode **)malloc(g->width * g->height * sizeof(GNode *));
+  int head = 0, tail = 0;
+  bool found = (g->entrance == g->exit);
+  
+  seen[tail++] = g->entrance;
+  g->entrance->processed = true;
+  while (head < tail && !found)
+  {
+    GNode * explorer = seen[head++];
+    for (int n = 0; n < NEIGHBOR_MAX; n++)
+    {
+      GNode * neigh = explorer->neighbors[n];
+      if (neigh == 0 || neigh->processed || neigh->neighbors[(n + 2) % NEIGHBOR_MAX] != explorer) continue;
+      if (neigh->tile != 'X' && neigh->tile != 'F') continue;
+      if (neigh == g->exit) found = true;
+      neigh->processed = true;
+      seen[tail++] = neigh;
+    }
+  }
+  
+  while (tail > 0) seen[--tail]->processed = false;
+  free(seen);
+  return found;
+}
+
+// Hierarchical search.
+bool runHierarchicalSearch(Hierarchy * h, int width, int height, GNode * arr[][height], Graph * g)
+{
+  GNode * entrance = g->entrance;
+  GNode * exit = g->exit;
+  GNode * node;
+  GNode * prev;
+  PortalStep step;
+  
+  // Catch up with whatever switchPassable() did since last time. The rebuilds count as part of this search.
+  STATS_BEGIN(h->stats, "hierarchical", 1);
+  refreshHierarchy(h, width, height, arr);
+  
+  int cluster_in = getNodeCluster(h, entrance);
+  int cluster_out = getNodeCluster(h, exit);
+  int dist_in[4 * h->cluster_size];
+  int dist_out[4 * h->cluster_size];
+  for (int i = 0; i < 4 * h->cluster_size; i++) dist_in[i] = dist_out[i] = -1;
+  
+  // Entrance and exit are temporary members of the abstract graph, linked to the portals of their clusters.
+  // If both share a cluster, the path that never leaves it is our first candidate.
+  int best = searchCluster(h, cluster_in, entrance, (cluster_in == cluster_out) ? exit : 0, dist_in);
+  clearCluster(h, width, height, arr, cluster_in);
+  searchCluster(h, cluster_out, exit, 0, dist_out);
+  clearCluster(h, width, height, arr, cluster_out);
+  GNode * best_portal = 0;
+  
+  // High-level search. Unit steps become weighted edges up here, so it is a Dijkstra instead of a BFS.
+  h->query++;
+  h->heap_length = 0;
+  for (int i = 0; i < h->clusters[cluster_in].portal_count; i++)
+  {
+    if (dist_in[i] >= 0) relaxPortal(h, h->clusters[cluster_in].portals[i], dist_in[i], 0);
+  }
+  
+  while (popPortalStep(h, &step))
+  {
+    if (best >= 0 && step.cost >= best) break;
+    STATS_NODE(h->stats);
+    
+    int c = getNodeCluster(h, step.node);
+    Cluster * cl = &h->clusters[c];
+    int i = step.node->portal;
+    
+    // A cheaper copy of this step was already expanded.
+    if (step.cost > cl->cost[i]) continue;
+    
+    if (c == cluster_out && dist_out[i] >= 0 && (best < 0 || step.cost + dist_out[i] < best)) {
+      best = step.cost + dist_out[i];
+      best_portal = step.node;
+    }
+    
+    // Intra-cluster edges.
+    for (int j = 0; j < cl->portal_count; j++)
+    {
+      if (cl->dist[i * cl->portal_count + j] > 0)
+        relaxPortal(h, cl->portals[j], step.cost + cl->dist[i * cl->portal_count + j], step.node);
+    }
+    
+    // Inter-cluster edges, one step across the border to a portal of the cluster beside us.
+    for (int n = 0; n < NEIGHBOR_MAX; n++)
+    {
+      node = step.node->neighbors[n];
+      if (node != 0 && node->portal >= 0 && node->neighbors[(n + 2) % NEIGHBOR_MAX] == step.node && getNodeCluster(h, node) != c)
+        relaxPortal(h, node, step.cost + 1, step.node);
+    }
+  }
+  
+  if (best < 0) {
+    STATS_END(h->stats, -1);
+    return false;
+  }
+  
+  // Refine only the cluster segments the route uses, walking it backwards from the exit.
+  // Consecutive nodes on different clusters are neighbors, there is nothing to refine between them.
+  // Every portal is marked on its own too: one the route enters and leaves through right away is no segment's end.
+  prev = exit;
+  node = best_portal;
+  while (node != 0)
+  {
+    node->tile = 'X';
+    if (getNodeCluster(h, node) == getNodeCluster(h, prev))
+      markClusterPath(h, width, height, arr, getNodeCluster(h, node), node, prev);
+    prev = node;
+    node = h->clusters[getNodeCluster(h, node)].from[node->portal];
+  }
+  markClusterPath(h, width, height, arr, cluster_in, entrance, prev);
+  
+  exit->tile = 'F';
+  entrance->tile = 'S';
+  
+  STATS_END(h->stats, best);
+  return true;
+}
+
+// Flow field constructor.
+void buildFlowField(FlowField * f, int width, int height)
+{
+  f->width = width;
+  f->height = height;
+  int tiles = getTileCount(width, height);
+  f->dist = (int *)malloc(tiles * sizeof(int));
+  f->step = (unsigned char *)malloc(tiles);
+#ifdef SEARCH_STATS
+  f->stats = 0;
+#endif
+  for (int i = 0; i < tiles; i++)
+  {
+    f->dist[i] = -1;
+    f->step[i] = FLOW_NONE;
+  }
+}
 
+// Flow field destructor.
+void destroyFlowField(FlowField * f)
+{
+  free(f->dist);
+  free(f->step);
+  f->dist = 0;
+  f->step = 0;
+}
 
+// Multi-source reverse Breadth-First Search.
+void runFlowField(FlowField * f, GNode * goals[], int goal_count)
+{
+  Queue * frontier = newQueue();
+  GNode * explorer;
+  GNode * neigh;
+  int tiles = getTileCount(f->width, f->height);
+  int i;
+  
+  for (i = 0; i < tiles; i++)
+  {
+    f->dist[i] = -1;
+    f->step[i] = FLOW_NONE;
+  }
+  
+  // All goals start at distance 0, that is all it takes to make it multi-source.
+  for (int g = 0; g < goal_count; g++)
+  {
+    i = getTileIndex(f->width, goals[g]->x, goals[g]->y);
+    if (f->dist[i] == 0) continue;
+    f->dist[i] = 0;
+    f->step[i] = FLOW_GOAL;
+    enqueue(frontier, goals[g]);
+  }
+  
+  STATS_BEGIN(f->stats, "flow_field", frontier->length);
+  while (!isQueueEmpty(frontier))
+  {
+    explorer = dequeue(frontier);
+    int d = f->dist[getTileIndex(f->width, explorer->x, explorer->y)];
+    
+    // We walk backwards, so the neighbor must be able to step into explorer, not the other way around.
+    // The distance doubles as the visited mark, so every tile is enqueued once.
+    for (int n = 0; n < NEIGHBOR_MAX; n++){
+      neigh = explorer->neighbors[n];
+      if (neigh == 0 || neigh->neighbors[(n + 2) % NEIGHBOR_MAX] != explorer) continue;
+      i = getTileIndex(f->width, neigh->x, neigh->y);
+      if (f->dist[i] >= 0) continue;
+      f->dist[i] = d + 1;
+      f->step[i] = (n + 2) % NEIGHBOR_MAX;
+      enqueue(frontier, neigh);
+    }
+    
+    STATS_EXPANDED(f->stats, frontier->length);
+  }
+  
+  // There is no single path here, every reachable tile has its own.
+  STATS_END(f->stats, -1);
+  free(frontier);
+}
 
+// Flow field lookup.
+GNode * getFlowStep(const FlowField * f, const GNode * from)
+{
+  unsigned char step = f->step[getTileIndex(f->width, from->x, from->y)];
+  if (step >= NEIGHBOR_MAX) return 0;
+  return from->neighbors[step];
+}
 
+// Flow field walk.
+bool followFlowField(const FlowField * f, GNode * from)
+{
+  GNode * explorer = from;
+  
+  if (f->step[getTileIndex(f->width, from->x, from->y)] == FLOW_NONE) return false;
+  
+  while (getFlowStep(f, explorer) != 0)
+  {
+    explorer->tile = 'X';
+    explorer = getFlowStep(f, explorer);
+  }
+  
+  explorer->tile = 'F';
+  if (explorer != from) from->tile = 'S';
+  
+  return true;
+}
 
+// Flow field display.
+void printFlowField(const FlowField * f)
+{
+  const char glyphs[] = {'^', '>', 'v', '<', 'G', '#'}; // Indexed by step, see FLOW_GOAL and FLOW_NONE.
+  
+  printf(" Printing flow field steps:\n\n");
+  for (int y = 0; y < f->height; y++)
+  {
+    for (int x = 0; x < f->width; x++)
+    {
+      printf("  %c", glyphs[f->step[getTileIndex(f->width, x, y)]]);
+    }
+    printf("\n\n");
+  }
+}
 
+// Search context constructor.
+void buildSearchContext(SearchContext * ctx, int width, int height)
+{
+  ctx->width = width;
+  ctx->height = height;
+  ctx->seen = (unsigned *)calloc(getTileCount(width, height), sizeof(unsigned));
+  ctx->stamp = 0;
+  ctx->parent = (GNode **)malloc(getTileCount(width, height) * sizeof(GNode *));
+  ctx->frontier = (GNode **)malloc(width * height * sizeof(GNode *));
+  ctx->pool = 0;
+}
 
+// Search context destructor.
+void destroySearchContext(SearchContext * ctx)
+{
+  free(ctx->seen);
+  free(ctx->parent);
+  free(ctx->frontier);
+  ctx->seen = 0;
+  ctx->parent = ctx->frontier = 0;
+}
 
+// Read-only Breadth-First Search.
+bool runContextSearch(SearchContext * ctx, PathQuery * query)
+{
+  int head = 0, tail = 0;
+  int i;
+  GNode * explorer = 0;
+  GNode * neigh;
+  
+  // New stamp, so everything seen by the previous search is unseen now. Clear for real only on wrap around.
+  ctx->stamp++;
+  if (ctx->stamp == 0) {
+    int tiles = getTileCount(ctx->width, ctx->height);
+    for (i = 0; i < tiles; i++) ctx->seen[i] = 0;
+    ctx->stamp = 1;
+  }
+  
+  query->length = -1;
+  i = getTileIndex(ctx->width, query->entrance->x, query->entrance->y);
+  ctx->seen[i] = ctx->stamp;
+  ctx->parent[i] = 0;
+  ctx->frontier[tail++] = query->entrance;
+  STATS_BEGIN(query->stats, "context", 1);
+  
+  // Marking on enqueue, so the frontier never holds a node twice and never outgrows width * height.
+  while (head < tail)
+  {
+    explorer = ctx->frontier[head++];
+    // The exit counts as expanded, as it does for the other engines, even though its neighbors are not needed.
+    if (explorer == query->exit) {
+      STATS_EXPANDED(query->stats, tail - head);
+      break;
+    }
+    
+    for (int n = 0; n < NEIGHBOR_MAX; n++){
+      neigh = explorer->neighbors[n];
+      if (neigh == 0) continue;
+      i = getTileIndex(ctx->width, neigh->x, neigh->y);
+      if (ctx->seen[i] == ctx->stamp) continue;
+      ctx->seen[i] = ctx->stamp;
+      ctx->parent[i] = explorer;
+      ctx->frontier[tail++] = neigh;
+    }
+    
+    STATS_EXPANDED(query->stats, tail - head);
+  }
+  
+  if (explorer != query->exit) {
+    STATS_END(query->stats, -1);
+    return false;
+  }
+  
+  // Count the steps back to the entrance, then write the path front to back if there is room for it.
+  query->length = 0;
+  for (neigh = explorer; neigh != query->entrance; neigh = ctx->parent[getTileIndex(ctx->width, neigh->x, neigh->y)])
+    query->length++;
+  
+  if (query->path != 0 && query->length < query->path_capacity) {
+    i = query->length;
+    for (neigh = explorer; neigh != 0; neigh = ctx->parent[getTileIndex(ctx->width, neigh->x, neigh->y)])
+      query->path[i--] = neigh;
+  }
+  
+  STATS_END(query->stats, query->length);
+  return true;
+}
 
+// Search pool constructor.
+void buildSearchPool(SearchPool * pool, int thread_count, int width, int height)
+{
+  pool->threads = (pthread_t *)malloc(thread_count * sizeof(pthread_t));
+  pool->contexts = (SearchContext *)malloc(thread_count * sizeof(SearchContext));
+  pool->thread_count = thread_count;
+  pool->queries = 0;
+  pool->query_count = pool->next_query = pool->done_count = 0;
+  pool->stop = false;
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->work, 0);
+  pthread_cond_init(&pool->done, 0);
+  
+  for (int t = 0; t < thread_count; t++)
+  {
+    buildSearchContext(&pool->contexts[t], width, height);
+    pool->contexts[t].pool = pool;
+    pthread_create(&pool->threads[t], 0, searchPoolWorker, &pool->contexts[t]);
+  }
+}
 
+// Search pool destructor.
+void destroySearchPool(SearchPool * pool)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  
+  for (int t = 0; t < pool->thread_count; t++)
+  {
+    pthread_join(pool->threads[t], 0);
+    destroySearchContext(&pool->contexts[t]);
+  }
+  
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->done);
+  free(pool->threads);
+  free(pool->contexts);
+  pool->threads = 0;
+  pool->contexts = 0;
+}
 
+// Batch dispatch.
+void runSearchPool(SearchPool * pool, PathQuery queries[], int query_count)
+{
+  pthread_mutex_lock(&pool->lock);
+  pool->queries = queries;
+  pool->query_count = query_count;
+  pool->next_query = pool->done_count = 0;
+  pthread_cond_broadcast(&pool->work);
+  
+  while (pool->done_count < pool->query_count) pthread_cond_wait(&pool->done, &pool->lock);
+  
+  pool->queries = 0;
+  pool->query_count = pool->next_query = pool->done_count = 0;
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// Pool thread.
+void * searchPoolWorker(void * context)
+{
+  SearchContext * ctx = (SearchContext *)context;
+  SearchPool * pool = ctx->pool;
+  PathQuery * query;
+  
+  pthread_mutex_lock(&pool->lock);
+  while (1)
+  {
+    // Sleep until there is something to take or we are told to go.
+    while (!pool->stop && pool->next_query >= pool->query_count) pthread_cond_wait(&pool->work, &pool->lock);
+    if (pool->stop) break;
+    
+    query = &pool->queries[pool->next_query++];
+    
+    // The search itself runs unlocked. That is the whole point.
+    pthread_mutex_unlock(&pool->lock);
+    runContextSearch(ctx, query);
+    pthread_mutex_lock(&pool->lock);
+    
+    pool->done_count++;
+    if (pool->done_count == pool->query_count) pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  
+  return 0;
+}
+
+#ifdef SEARCH_STATS
+// Search statistics constructor.
+void buildSearchStats(SearchStats * s)
+{
+  s->engine = "";
+  s->expanded = s->duplicates = s->frontier_peak = 0;
+  s->path_length = -1;
+  s->wall_time = 0;
+  s->levels = 0;
+  s->level_count = s->level_capacity = 0;
+  s->level = 0;
+  s->level_left = 0;
+}
+
+// Search statistics destructor.
+void destroySearchStats(SearchStats * s)
+{
+  free(s->levels);
+  s->levels = 0;
+  s->level_count = s->level_capacity = 0;
+}
 
+// Search start.
+void beginSearchStats(SearchStats * s, const char * engine, long sources)
+{
+  s->engine = engine;
+  s->expanded = s->duplicates = 0;
+  s->frontier_peak = sources;
+  s->path_length = -1;
+  s->level_count = 0;
+  s->level = 0;
+  s->level_left = sources;
+  timespec_get(&s->started, TIME_UTC);
+}
 
+// Search end.
+void endSearchStats(SearchStats * s, int path_length)
+{
+  struct timespec now;
+  timespec_get(&now, TIME_UTC);
+  s->wall_time = (now.tv_sec - s->started.tv_sec) + (now.tv_nsec - s->started.tv_nsec) / 1e9;
+  s->path_length = path_length;
+}
 
+// Level-aware expansion count.
+void countExpanded(SearchStats * s, long queued)
+{
+  if (s->level == s->level_count) {
+    if (s->level_count == s->level_capacity) {
+      s->level_capacity = (s->level_capacity == 0) ? 64 : s->level_capacity * 2;
+      s->levels = (long *)realloc(s->levels, s->level_capacity * sizeof(long));
+    }
+    s->levels[s->level_count++] = 0;
+  }
+  
+  s->expanded++;
+  s->levels[s->level]++;
+  if (queued > s->frontier_peak) s->frontier_peak = queued;
+  
+  // Everything queued by now belongs to the next level, since a FIFO never lets levels mix.
+  if (--s->level_left == 0) {
+    s->level++;
+    s->level_left = queued;
+  }
+}
 
+// JSON line output.
+void printSearchStats(FILE * out, const SearchStats * s)
+{
+  fprintf(out, "{\"engine\":\"%s\",\"expanded\":%ld,\"duplicates\":%ld,\"frontier_peak\":%ld,\"path_length\":%d,\"wall_time\":%.9f,\"levels\":[",
+          s->engine, s->expanded, s->duplicates, s->frontier_peak, s->path_length, s->wall_time);
+  for (int i = 0; i < s->level_count; i++) fprintf(out, (i == 0) ? "%ld" : ",%ld", s->levels[i]);
+  fprintf(out, "]}\n");
+}
+#endif
 
+// Graph constructor from a map.
+void buildGraphFromMap(Graph * g, int width, int height, GNode * arr[][height], const char * map)
+{
+  g->width = width;
+  g->height = height;
+  g->entrance = 0;
+  g->exit = 0;
+#ifdef SEARCH_STATS
+  g->stats = 0;
+#endif
+  
+  // One block for every node, laid out like the other per-tile arrays, instead of one malloc() per node.
+  GNode * nodes = (GNode *)malloc(getTileCount(width, height) * sizeof(GNode));
+  
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      arr[x][y] = &nodes[getTileIndex(width, x, y)];
+      clearNode(arr[x][y]);
+      arr[x][y]->x = x;
+      arr[x][y]->y = y;
+      if (map[y * width + x] == '#') arr[x][y]->tile = '#';
+    }
+  }
+  
+  // Open nodes link to open neighbors only. A wall keeps its links to open neighbors, but nobody links back to it,
+  // which is the state switchPassable() leaves it in, so it can still switch it back.
+  for (int y = 0; y < height; y++)
+  {
+    for (int x = 0; x < width; x++)
+    {
+      if (y > 0 && arr[x][y - 1]->tile != '#') setNodeNeighbor(arr[x][y], NEIGHBOR_TOP, arr[x][y - 1]);
+      if (x < width - 1 && arr[x + 1][y]->tile != '#') setNodeNeighbor(arr[x][y], NEIGHBOR_RIGHT, arr[x + 1][y]);
+      if (y < height - 1 && arr[x][y + 1]->tile != '#') setNodeNeighbor(arr[x][y], NEIGHBOR_BOT, arr[x][y + 1]);
+      if (x > 0 && arr[x - 1][y]->tile != '#') setNodeNeighbor(arr[x][y], NEIGHBOR_LEFT, arr[x - 1][y]);
+    }
+  }
+  
+  g->beginning = arr[0][0];
+}
 
+// Tile index.
+int getTileIndex(int width, int x, int y)
+{
+#ifdef TILE_LAYOUT_MORTON
+  int blocks_w = (width + TILE_BLOCK - 1) >> TILE_BLOCK_BITS;
+  int block = (y >> TILE_BLOCK_BITS) * blocks_w + (x >> TILE_BLOCK_BITS);
+  return (block << (2 * TILE_BLOCK_BITS)) | mortonEncode(x & (TILE_BLOCK - 1), y & (TILE_BLOCK - 1));
+#else
+  return y * width + x;
+#endif
+}
 
+// Tile count.
+int getTileCount(int width, int height)
+{
+#ifdef TILE_LAYOUT_MORTON
+  int blocks_w = (width + TILE_BLOCK - 1) >> TILE_BLOCK_BITS;
+  int blocks_h = (height + TILE_BLOCK - 1) >> TILE_BLOCK_BITS;
+  return (blocks_w * blocks_h) << (2 * TILE_BLOCK_BITS);
+#else
+  return width * height;
+#endif
+}
 
+#ifdef TILE_LAYOUT_MORTON
+// Bit interleaving.
+unsigned mortonEncode(unsigned x, unsigned y)
+{
+#ifdef __BMI2__
+  return _pdep_u32(x, 0x55555555) | _pdep_u32(y, 0xAAAAAAAA);
+#else
+  // Spread the 16 low bits apart, one zero between each of them.
+  x = (x | (x << 8)) & 0x00FF00FF;
+  x = (x | (x << 4)) & 0x0F0F0F0F;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  y = (y | (y << 8)) & 0x00FF00FF;
+  y = (y | (y << 4)) & 0x0F0F0F0F;
+  y = (y | (y << 2)) & 0x33333333;
+  y = (y | (y << 1)) & 0x55555555;
+  return x | (y << 1);
+#endif
+}
+#endif
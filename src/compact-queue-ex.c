@@ -0,0 +1,46 @@
+/* compact-queue-ex.c -- lcfcompact.h holding a backlog of IDs, next to a lcfqueue.h Queue doing the same. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "lcfqueue.h"
+#include "lcfcompact.h"
+
+#define ID_COUNT 1000000
+
+int main(void) {
+  printf("\nQueuing %d mostly increasing IDs in both queues...\n\n", ID_COUNT);
+  
+  CompactQueue * cq = newCompactQueue();
+  Queue * q = newQueue();
+  long long id = 1000000000LL;
+  bool ok = true;
+  
+  for (int i = 0; i < ID_COUNT; i++) {
+    // Mostly +1, now and then a jump ahead or a late one from behind.
+    if (i % 100 == 0) id += 5000;
+    else if (i % 37 == 0) id -= 3;
+    else id++;
+    if (!compactEnqueue(cq, id) || !enqueue(q, (int)(id % 1000000000))) {
+      printf("Failed on allocate memory.\n");
+      return 1;
+    }
+  }
+  
+  printf("CompactQueue has %llu elements in %zu bytes, %.2f bytes each.\n",
+         (unsigned long long)cq->length, getCompactQueueBytes(cq), (double)getCompactQueueBytes(cq) / cq->length);
+  printf("Queue has %lld elements in at least %zu bytes, %.2f bytes each before malloc() headers.\n\n",
+         q->length, sizeof(Queue) + (size_t)q->length * sizeof(QElem), (double)sizeof(QElem));
+  
+  printf("Dequeuing and comparing them...\n");
+  while (!isCompactQueueEmpty(cq)) {
+    if (compactDequeue(cq) % 1000000000 != dequeue(q)) ok = false;
+  }
+  if (ok && isQueueEmpty(q)) printf("Same values, same order.\n");
+    else printf("The queues do not match!\n");
+  
+  destroyCompactQueue(cq);
+  free(q);
+  
+  printf("\nDone.\n");
+  
+  return 0;
+}
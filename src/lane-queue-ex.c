@@ -0,0 +1,64 @@
+/* lane-queue-ex.c -- lcflanes.h keeping a noisy tenant from starving the quiet ones. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "lcflanes.h"
+
+#define TENANTS 10
+#define NOISY_JOBS 100000  // Lane 0 floods the queue...
+#define QUIET_JOBS 10      // ...while every other lane asks for a little.
+#define MANY_LANES 4096
+#define MANY_JOBS 1000000
+
+int main(void) {
+  printf("\nLane 0 queues %d jobs, lanes 1 to %d queue %d each, lane %d has weight 3.\n\n",
+         NOISY_JOBS, TENANTS - 1, QUIET_JOBS, TENANTS - 1);
+  
+  LaneQueue * q = newLaneQueue(TENANTS);
+  int done_at[TENANTS] = {0};
+  int lane;
+  
+  setLaneWeight(q, TENANTS - 1, 3);
+  for (int i = 0; i < NOISY_JOBS; i++) laneEnqueue(q, 0, i);
+  for (int t = 1; t < TENANTS; t++) {
+    for (int i = 0; i < QUIET_JOBS; i++) laneEnqueue(q, t, i);
+  }
+  
+  // With a single Queue, every quiet job would come out after the whole burst.
+  for (int n = 1; !isLaneQueueEmpty(q); n++) {
+    laneDequeue(q, &lane);
+    done_at[lane] = n;
+  }
+  for (int t = 0; t < TENANTS; t++) printf("Lane %d was done after %d dequeues.\n", t, done_at[t]);
+  
+  destroyLaneQueue(q);
+  
+  // Cost per dequeue with thousands of lanes, most of them empty most of the time.
+  printf("\nSpreading %d jobs over %d lanes and dequeuing them...\n", MANY_JOBS, MANY_LANES);
+  
+  q = newLaneQueue(MANY_LANES);
+  unsigned seed = 42;
+  for (int i = 0; i < MANY_JOBS; i++) {
+    seed = seed * 1103515245 + 12345;
+    // Skewed: a handful of lanes get most of the jobs.
+    int t = (seed >> 16) % 4 == 0 ? (seed >> 8) % MANY_LANES : (seed >> 8) % 16;
+    laneEnqueue(q, t, i);
+  }
+  
+  struct timespec t0, t1;
+  timespec_get(&t0, TIME_UTC);
+  long long count = 0;
+  while (!isLaneQueueEmpty(q)) {
+    laneDequeue(q, 0);
+    count++;
+  }
+  timespec_get(&t1, TIME_UTC);
+  double took = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  printf("Dequeued %lld jobs, %.1f ns each.\n", count, took / count * 1e9);
+  
+  destroyLaneQueue(q);
+  
+  printf("\nDone.\n");
+  
+  return 0;
+}
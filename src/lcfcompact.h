@@ -0,0 +1,245 @@
+/* lcfcompact.h -- A compact FIFO/Queue for integers, packed into blocks at 1 or 2 bytes per element. */
+#ifndef LCFCOMPACT_H_
+#define LCFCOMPACT_H_
+
+#ifndef _STDBOOL_H
+#include <stdbool.h> /* Same deal as in lcfqueue.h: -std=c11 and chill. */
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* --- Why another queue? ---
+   A lcfqueue.h Queue of int spends 4 bytes on the value, 16 on the next and prev pointers and some more on padding
+   and malloc() headers, around 40 bytes for each element. Fine for a hundred nodes, not for millions of IDs.
+   This one only holds integers (long long), but stores each of them as the difference from the one enqueued
+   before it, zigzag and varint encoded. Mostly increasing IDs take 1 byte each, 2 when they jump up to 8191 ahead.
+   Values go into blocks of COMPACT_BLOCK_BYTES, linked by 32 bits block numbers instead of pointers, and emptied
+   blocks are kept for reuse, so there is no malloc() per element either.
+   The length is 64 bits, so it will not wrap around past 2^31 elements. Here is how it goes:
+
+#include "lcfcompact.h"
+...
+CompactQueue * q = newCompactQueue();
+compactEnqueue(q, 1000);
+compactEnqueue(q, 1001);
+long long id = compactDequeue(q); // 1000
+...
+destroyCompactQueue(q);
+*/
+
+#ifndef COMPACT_BLOCK_BYTES
+#define COMPACT_BLOCK_BYTES 248 // With its header, a block is 256 bytes. Define it before including to change it.
+#endif
+
+#define COMPACT_NONE UINT32_MAX   // Block number meaning "no block".
+#define COMPACT_VARINT_MAX 10     // Bytes a 64 bits varint can take.
+
+
+/* -- Type definitions -- */
+
+// Block of encoded values
+typedef struct compact_block {
+  uint32_t next;                          // Next block number, COMPACT_NONE for the last one.
+  uint32_t used;                          // Bytes written so far.
+  unsigned char bytes[COMPACT_BLOCK_BYTES];
+} CompactBlock;
+
+// Compact queue definition
+typedef struct compact_queue {
+  CompactBlock * blocks;  // Every block the queue owns, in use or free. Grows with realloc(), hence the numbers.
+  uint32_t block_count;
+  uint32_t block_capacity;
+  uint32_t free_list;     // Emptied blocks, linked through next.
+  uint32_t head, tail;    // Block numbers, COMPACT_NONE when empty.
+  uint32_t head_read;     // Bytes of the head block already dequeued.
+  long long head_value;   // Last value dequeued, the base for the next delta read.
+  long long tail_value;   // Last value enqueued, the base for the next delta written.
+  uint64_t length;
+} CompactQueue;
+
+
+/* -- Function prototypes and how to -- */
+
+// Initializer
+CompactQueue * newCompactQueue();
+/* operation:          Initializes a compact queue.                          */
+/* preconditions:      Use like this: CompactQueue * q = newCompactQueue(); */
+/* postconditions:     A empty CompactQueue, or 0 if malloc() failed.       */
+
+// Finalizer
+void destroyCompactQueue(CompactQueue *);
+/* operation:          Frees every block and the queue itself. */
+/* preconditions:      A queue from newCompactQueue().         */
+/* postconditions:     Nothing left, do not use q again.       */
+
+// Push procedure
+bool compactEnqueue(CompactQueue *, const long long);
+/* operation:        Pushes val to the end of the queue.                                          */
+/* preconditions:    A initialized queue.                                                         */
+/* postconditions:   Returns true on success, false if a new block was needed and could not be    */
+/*                   allocated. The queue is untouched then.                                      */
+
+// Pop procedure
+long long compactDequeue(CompactQueue *);
+/* operation:         Pops the value at the head of the queue.                              */
+/* preconditions:     A initialized queue.                                                  */
+/* postconditions:    Returns the value, or 0 if the queue was empty, just like dequeue().  */
+/*                    The head block goes to the free list once it has been read through.  */
+
+// Emptiness verification
+bool isCompactQueueEmpty(const CompactQueue *);
+/* operation:            Determines if there are elements on the queue.           */
+/* preconditions:        A initialized queue.                                     */
+/* postconditions:       Returns true if empty and false if there is at least one */
+/*                       element.                                                 */
+
+// Memory used
+size_t getCompactQueueBytes(const CompactQueue *);
+/* operation:            Returns the bytes allocated for the queue, free blocks included. */
+/* preconditions:        A initialized queue.                                             */
+/* postconditions:       Nothing changes.                                                 */
+
+// Block allocation, called from compactEnqueue().
+uint32_t newCompactBlock(CompactQueue *);
+/* operation:        Takes a block from the free list, or from the end of blocks, growing it if needed. */
+/* preconditions:    A initialized queue.                                                              */
+/* postconditions:   The number of a empty block, or COMPACT_NONE if realloc() failed.                 */
+
+
+
+/* --- Function actual implementation --- */
+
+// Initializer -- no block until the first value comes.
+CompactQueue * newCompactQueue()
+{
+  CompactQueue * q = (CompactQueue *)malloc(sizeof(CompactQueue));
+  if (q == NULL) return q;
+  q->blocks = 0;
+  q->block_count = q->block_capacity = 0;
+  q->free_list = q->head = q->tail = COMPACT_NONE;
+  q->head_read = 0;
+  q->head_value = q->tail_value = 0;
+  q->length = 0;
+  return q;
+}
+
+// Finalizer
+void destroyCompactQueue(CompactQueue * q)
+{
+  free(q->blocks);
+  free(q);
+}
+
+// Block allocation
+uint32_t newCompactBlock(CompactQueue * q)
+{
+  uint32_t b = q->free_list;
+  
+  if (b != COMPACT_NONE) {
+    q->free_list = q->blocks[b].next;
+  }
+  else {
+    if (q->block_count == q->block_capacity) {
+      // Double it, but block numbers must stay below COMPACT_NONE.
+      uint32_t capacity = (q->block_capacity == 0) ? 4 : q->block_capacity * 2;
+      if (capacity < q->block_capacity || capacity == COMPACT_NONE) capacity = COMPACT_NONE - 1;
+      if (capacity == q->block_capacity) return COMPACT_NONE;
+      CompactBlock * blocks = (CompactBlock *)realloc(q->blocks, (size_t)capacity * sizeof(CompactBlock));
+      if (blocks == NULL) return COMPACT_NONE;
+      q->blocks = blocks;
+      q->block_capacity = capacity;
+    }
+    b = q->block_count++;
+  }
+  
+  q->blocks[b].next = COMPACT_NONE;
+  q->blocks[b].used = 0;
+  return b;
+}
+
+// Push operation
+bool compactEnqueue(CompactQueue * q, const long long val) {
+  // Zigzag the delta, so small steps back are small numbers too: 0, -1, 1, -2... become 0, 1, 2, 3...
+  // The subtraction is done unsigned, it may wrap and the reader wraps it back the same way.
+  uint64_t delta = (uint64_t)val - (uint64_t)q->tail_value;
+  uint64_t zigzag = (delta << 1) ^ (uint64_t)(-(int64_t)(delta >> 63));
+  unsigned char encoded[COMPACT_VARINT_MAX];
+  int size = 0;
+  
+  // Varint: 7 bits per byte, lowest first, the high bit says another byte follows.
+  do {
+    encoded[size] = zigzag & 0x7F;
+    zigzag >>= 7;
+    if (zigzag != 0) encoded[size] |= 0x80;
+    size++;
+  } while (zigzag != 0);
+  
+  // A value never spans two blocks, the reader would have to stitch them.
+  if (q->tail == COMPACT_NONE || q->blocks[q->tail].used + size > COMPACT_BLOCK_BYTES) {
+    uint32_t b = newCompactBlock(q);
+    if (b == COMPACT_NONE) return false;
+    if (q->tail == COMPACT_NONE) {
+      q->head = b;
+      q->head_read = 0;
+    }
+    else q->blocks[q->tail].next = b;
+    q->tail = b;
+  }
+  
+  CompactBlock * block = &q->blocks[q->tail];
+  memcpy(&block->bytes[block->used], encoded, size);
+  block->used += size;
+  q->tail_value = val;
+  q->length++;
+  return true;
+}
+
+// Pop operation
+long long compactDequeue(CompactQueue * q) {
+  // If queue is empty, there is nothing to dequeue
+  if (q->length == 0) return 0;
+  
+  CompactBlock * block = &q->blocks[q->head];
+  uint64_t zigzag = 0;
+  int shift = 0;
+  unsigned char byte;
+  
+  do {
+    byte = block->bytes[q->head_read++];
+    zigzag |= (uint64_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  
+  uint64_t delta = (zigzag >> 1) ^ (uint64_t)(-(int64_t)(zigzag & 1));
+  q->head_value = (long long)((uint64_t)q->head_value + delta);
+  q->length--;
+  
+  // Read through the head block, give it back. The last block is kept while the queue has it as tail.
+  if (q->head_read == block->used && q->head != q->tail) {
+    uint32_t next = block->next;
+    block->next = q->free_list;
+    q->free_list = q->head;
+    q->head = next;
+    q->head_read = 0;
+  }
+  // Empty now. Rewind the last block instead of freeing it, the next value goes right back in.
+  else if (q->length == 0) {
+    block->used = 0;
+    q->head_read = 0;
+  }
+  
+  return q->head_value;
+}
+
+// Empty? -- simple true/false for emptiness checking.
+bool isCompactQueueEmpty(const CompactQueue * q) {
+  return q->length == 0;
+}
+
+// Memory used
+size_t getCompactQueueBytes(const CompactQueue * q) {
+  return sizeof(CompactQueue) + (size_t)q->block_capacity * sizeof(CompactBlock);
+}
+
+#endif
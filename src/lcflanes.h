@@ -0,0 +1,248 @@
+/* lcflanes.h -- A multi-lane queue: one lcfqueue.h Queue per lane, dequeued in weighted round-robin. */
+#ifndef LCFLANES_H_
+#define LCFLANES_H_
+
+#include <stdint.h>
+#include "lcfqueue.h" // Brings VAL_TYPE along, so #define it before including this one, same as there.
+
+/* --- Why lanes? ---
+   Put everyone's work in one Queue and one noisy producer's burst sits in front of everybody else's. Here every
+   producer (tenant, client, connection...) gets a lane of its own, and laneDequeue() goes around the non-empty
+   lanes taking up to weight values from each before moving to the next: deficit round-robin where every value
+   costs 1. A lane with weight 3 gets three times the turns of a lane with weight 1 while both have work, and a
+   lane with nothing queued costs nothing.
+   Non-empty lanes are tracked in a bitmap, with a second bitmap on top telling which of its 64 bits words are not
+   zero. Finding the next lane with work is a couple of bit scans, with 10 lanes or 4096. Past 4096 the top bitmap
+   takes a word per 4096 lanes more to scan. Here is how it goes:
+
+#define VAL_TYPE Job *
+#include "lcflanes.h"
+...
+LaneQueue * q = newLaneQueue(tenant_count);
+setLaneWeight(q, premium_tenant, 4);
+laneEnqueue(q, job->tenant, job);
+...
+int tenant;
+Job * next = laneDequeue(q, &tenant);
+...
+destroyLaneQueue(q);
+*/
+
+
+/* -- Type definitions -- */
+
+// Lane definition
+typedef struct lane {
+  Queue queue;      // Plain lcfqueue.h storage.
+  int weight;       // Values taken per turn.
+  int credit;       // Values left in the current turn.
+} Lane;
+
+// Multi-lane queue definition
+typedef struct lane_queue {
+  Lane * lanes;
+  int lane_count;
+  uint64_t * active;    // Bit per lane, set while it has values.
+  uint64_t * summary;   // Bit per active word, set while it is not zero.
+  int word_count;
+  int summary_count;
+  int current;          // Lane whose turn it is, -1 before the first turn.
+  long long length;     // Values in all lanes.
+} LaneQueue;
+
+
+/* -- Function prototypes and how to -- */
+
+// Initializer
+LaneQueue * newLaneQueue(int lane_count);
+/* operation:          Initializes lane_count empty lanes, lanes 0 to lane_count - 1, all of weight 1. */
+/* preconditions:      Use like this: LaneQueue * q = newLaneQueue(lane_count);                       */
+/* postconditions:     A empty LaneQueue, or 0 if malloc() failed.                                    */
+
+// Finalizer
+void destroyLaneQueue(LaneQueue *);
+/* operation:          Dequeues whatever is left and frees every lane and the queue itself.       */
+/* preconditions:      A queue from newLaneQueue().                                                */
+/* postconditions:     Nothing left, do not use q again. Free the values first if they are yours. */
+
+// Weight setting
+void setLaneWeight(LaneQueue *, int lane, int weight);
+/* operation:          Sets how many values the lane gives per turn.                  */
+/* preconditions:      A initialized queue, a valid lane and a weight of at least 1.  */
+/* postconditions:     Takes effect from the lane's next turn on.                     */
+
+// Push procedure
+bool laneEnqueue(LaneQueue *, int lane, const VAL_TYPE);
+/* operation:        Pushes val to the end of the lane.                                    */
+/* preconditions:    A initialized queue and a valid lane.                                 */
+/* postconditions:   Returns true on success and false on failure in pushing, as enqueue(). */
+
+// Pop procedure
+VAL_TYPE laneDequeue(LaneQueue *, int * lane);
+/* operation:         Pops the head of the lane whose turn it is. When its turn is used up or it runs  */
+/*                    empty, the turn goes to the next non-empty lane, in lane order, wrapping around. */
+/* preconditions:     A initialized queue. lane may be 0 if you do not care where the value came from. */
+/* postconditions:    Returns the value, and its lane in *lane, or 0 and -1 if every lane was empty.   */
+
+// Emptiness verification
+bool isLaneQueueEmpty(const LaneQueue *);
+/* operation:            Determines if there are values in any lane.                   */
+/* preconditions:        A initialized queue.                                          */
+/* postconditions:       Returns true if every lane is empty, false if at least one is not. */
+
+// Next lane with values
+int getNextActiveLane(const LaneQueue *, int from);
+/* operation:            Returns the first non-empty lane at or after from, wrapping around the end. */
+/* preconditions:        A initialized queue, from between 0 and lane_count.                       */
+/* postconditions:       The lane, or -1 if every lane is empty.                                   */
+
+// Bitmap search, called from getNextActiveLane().
+int findActiveLane(const LaneQueue *, int from);
+/* operation:            Same as getNextActiveLane(), but without wrapping around. */
+/* preconditions:        A initialized queue.                                      */
+/* postconditions:       The lane, or -1 if there is none at or after from.        */
+
+
+
+/* --- Function actual implementation --- */
+
+// Initializer -- every lane empty, no turn started yet.
+LaneQueue * newLaneQueue(int lane_count)
+{
+  LaneQueue * q = (LaneQueue *)malloc(sizeof(LaneQueue));
+  if (q == NULL) return q;
+  
+  q->lane_count = lane_count;
+  q->word_count = (lane_count + 63) / 64;
+  q->summary_count = (q->word_count + 63) / 64;
+  q->lanes = (Lane *)malloc(lane_count * sizeof(Lane));
+  q->active = (uint64_t *)calloc(q->word_count, sizeof(uint64_t));
+  q->summary = (uint64_t *)calloc(q->summary_count, sizeof(uint64_t));
+  if (q->lanes == NULL || q->active == NULL || q->summary == NULL) {
+    free(q->lanes);
+    free(q->active);
+    free(q->summary);
+    free(q);
+    return 0;
+  }
+  
+  for (int i = 0; i < lane_count; i++)
+  {
+    q->lanes[i].queue.head = q->lanes[i].queue.tail = 0;
+    q->lanes[i].queue.length = 0;
+    q->lanes[i].weight = 1;
+    q->lanes[i].credit = 0;
+  }
+  q->current = -1;
+  q->length = 0;
+  return q;
+}
+
+// Finalizer
+void destroyLaneQueue(LaneQueue * q)
+{
+  for (int i = 0; i < q->lane_count; i++)
+  {
+    while (!isQueueEmpty(&q->lanes[i].queue)) dequeue(&q->lanes[i].queue);
+  }
+  free(q->lanes);
+  free(q->active);
+  free(q->summary);
+  free(q);
+}
+
+// Weight setting
+void setLaneWeight(LaneQueue * q, int lane, int weight)
+{
+  q->lanes[lane].weight = weight;
+}
+
+// Push operation
+bool laneEnqueue(LaneQueue * q, int lane, const VAL_TYPE val)
+{
+  if (!enqueue(&q->lanes[lane].queue, val)) return false;
+  
+  // First value of the lane, it goes on the bitmaps.
+  if (q->lanes[lane].queue.length == 1) {
+    q->active[lane / 64] |= 1ULL << (lane % 64);
+    q->summary[lane / 4096] |= 1ULL << ((lane / 64) % 64);
+  }
+  q->length++;
+  return true;
+}
+
+// Pop operation
+VAL_TYPE laneDequeue(LaneQueue * q, int * lane)
+{
+  if (q->length == 0) {
+    if (lane != 0) *lane = -1;
+    return 0;
+  }
+  
+  Lane * l = (q->current < 0) ? 0 : &q->lanes[q->current];
+  
+  // Turn over. The first turn starts the search at lane 0. An emptied lane already gave its turn up, so the next
+  // one may be the very same lane number.
+  if (l == 0 || l->queue.length == 0 || l->credit == 0) {
+    int from = (l == 0) ? 0 : (l->queue.length == 0) ? q->current : q->current + 1;
+    q->current = getNextActiveLane(q, (from == q->lane_count) ? 0 : from);
+    l = &q->lanes[q->current];
+    l->credit = l->weight;
+  }
+  
+  VAL_TYPE val = dequeue(&l->queue);
+  l->credit--;
+  q->length--;
+  if (lane != 0) *lane = q->current;
+  
+  // Last value of the lane, off the bitmaps. Whatever credit it had left is lost, as in deficit round-robin.
+  if (l->queue.length == 0) {
+    int c = q->current;
+    l->credit = 0;
+    q->active[c / 64] &= ~(1ULL << (c % 64));
+    if (q->active[c / 64] == 0) q->summary[c / 4096] &= ~(1ULL << ((c / 64) % 64));
+  }
+  
+  return val;
+}
+
+// Empty? -- simple true/false for emptiness checking.
+bool isLaneQueueEmpty(const LaneQueue * q)
+{
+  return q->length == 0;
+}
+
+// Next lane with values, wrapping around.
+int getNextActiveLane(const LaneQueue * q, int from)
+{
+  int lane = findActiveLane(q, from);
+  if (lane < 0 && from > 0) lane = findActiveLane(q, 0);
+  return lane;
+}
+
+// Next lane with values, up to the end.
+int findActiveLane(const LaneQueue * q, int from)
+{
+  int w = from / 64;
+  if (w >= q->word_count) return -1;
+  
+  // Rest of from's own word.
+  uint64_t bits = q->active[w] & (~0ULL << (from % 64));
+  if (bits != 0) return w * 64 + __builtin_ctzll(bits);
+  
+  // First non-zero word after it, from the summary.
+  w++;
+  for (int s = w / 64; s < q->summary_count; s++)
+  {
+    bits = q->summary[s];
+    if (s == w / 64) bits &= ~0ULL << (w % 64);
+    if (bits != 0) {
+      int word = s * 64 + __builtin_ctzll(bits);
+      return word * 64 + __builtin_ctzll(q->active[word]);
+    }
+  }
+  
+  return -1;
+}
+
+#endif
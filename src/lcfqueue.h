@@ -48,7 +48,7 @@ typedef struct queue_elem {
 typedef struct queue {
   QElem *head;
   QElem *tail;
-  int length;
+  long long length; // 64 bits, so it does not wrap around past 2^31 elements.
 } Queue;
 
 
@@ -0,0 +1,361 @@
+/* lcfwheel.h -- A hierarchical timing wheel: holds VAL_TYPE entries until their deadline, then hands them back. */
+#ifndef LCFWHEEL_H_
+#define LCFWHEEL_H_
+
+#ifndef _STDBOOL_H
+#include <stdbool.h> /* Same deal as in lcfqueue.h: -std=c11 and chill. */
+#endif
+#include <stdint.h>
+#include <stdlib.h>
+
+/* --- Type to be held in the wheel --- */
+#ifndef VAL_TYPE
+#define VAL_TYPE int // Same as lcfqueue.h. #define VAL_TYPE before including, and both headers hold your type.
+#endif
+
+/* --- Why a wheel? ---
+   Keeping retry and timeout events in a Queue means scanning all of them on every tick to find the due ones.
+   Here entries hang from slots by deadline instead. There are WHEEL_LEVELS wheels of WHEEL_SLOTS slots. Level 0
+   has a slot per tick, level 1 a slot per 64 ticks, level 2 per 4096 ticks, and so on. An entry sits on the
+   lowest level that tells its deadline apart from the current tick. When the clock reaches its slot, it drops to
+   a lower level ("cascades"), and from level 0 it becomes due. Scheduling and cancelling are O(1). A bitmap of
+   the non-empty slots of each level lets pollExpired() jump straight to the next tick with work, so idle ticks
+   cost nothing however many entries wait. A tick with work costs the entries it makes due plus the ones it
+   cascades. Each entry cascades at most once per level, so that evens out, but the ticks that start a new slot
+   of a high level do carry a burst.
+   Time is whatever you count ticks in: milliseconds, frames, rounds. Here is how it goes:
+
+#define VAL_TYPE MyEvent *
+#include "lcfwheel.h"
+...
+TimerWheel * w = newTimerWheel(now);
+TimerHandle h = scheduleTimer(w, now + 250, event);
+...
+cancelTimer(w, h); // Answered in time, no retry.
+...
+VAL_TYPE due[64];
+int count;
+while ((count = pollExpired(w, now, due, 64)) > 0) { ...fire due[0] to due[count - 1]... }
+...
+destroyTimerWheel(w);
+*/
+
+#define WHEEL_BITS 6                   // Slots per level is 2^WHEEL_BITS, and a uint64_t holds their bitmap.
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 8                 // 8 levels of 6 bits, deadlines up to 2^48 ticks ahead. Farther is fine too,
+                                       // they just cascade from the top level more than once.
+#define WHEEL_DUE (WHEEL_LEVELS * WHEEL_SLOTS) // Bucket of the entries past their deadline, not polled yet.
+#define WHEEL_FREE (WHEEL_DUE + 1)             // Bucket of the unused entries.
+#define WHEEL_NONE UINT32_MAX                  // Entry number meaning "no entry".
+#define TIMER_NONE 0                           // Handle that is never given out.
+
+
+/* -- Type definitions -- */
+
+// Handle to a scheduled entry: generation in the high 32 bits, entry number in the low ones. The generation
+// changes every time the entry is reused, so a handle to something already polled or cancelled is just ignored.
+typedef uint64_t TimerHandle;
+
+// Entry definition
+typedef struct timer_entry {
+  VAL_TYPE value;
+  uint64_t deadline;
+  uint32_t next, prev;    // Entry numbers in the same bucket.
+  uint32_t generation;
+  uint32_t bucket;        // level * WHEEL_SLOTS + slot, WHEEL_DUE or WHEEL_FREE.
+} TimerEntry;
+
+// Wheel definition
+typedef struct timer_wheel {
+  TimerEntry * entries;   // All of them, in use or free. Grows with realloc(), so they link by number.
+  uint32_t entry_count;
+  uint32_t entry_capacity;
+  uint32_t free_list;
+  uint32_t buckets[WHEEL_LEVELS * WHEEL_SLOTS];  // First entry of every slot.
+  uint64_t occupied[WHEEL_LEVELS];               // Bit s set when slot s of the level has entries.
+  uint32_t due_head, due_tail;                   // Due entries, in the order they became due.
+  uint64_t now;           // Last tick processed. Everything up to it is due already.
+  uint64_t count;         // Scheduled entries, due ones included.
+} TimerWheel;
+
+
+/* -- Function prototypes and how to -- */
+
+// Initializer
+TimerWheel * newTimerWheel(uint64_t now);
+/* operation:          Initializes a empty wheel, with its clock at now.             */
+/* preconditions:      Use like this: TimerWheel * w = newTimerWheel(now);           */
+/* postconditions:     A empty TimerWheel, or 0 if malloc() failed.                  */
+
+// Finalizer
+void destroyTimerWheel(TimerWheel *);
+/* operation:          Frees every entry and the wheel itself. Pending values are dropped. */
+/* preconditions:      A wheel from newTimerWheel().                                       */
+/* postconditions:     Nothing left, do not use w again.                                   */
+
+// Schedule procedure
+TimerHandle scheduleTimer(TimerWheel *, uint64_t deadline, const VAL_TYPE);
+/* operation:        Holds val until the clock reaches deadline.                                      */
+/* preconditions:    A initialized wheel.                                                             */
+/* postconditions:   A handle for cancelTimer(), or TIMER_NONE if there was no memory for the entry.  */
+/*                   A deadline already past is due right away, for the next pollExpired().          */
+
+// Cancel procedure
+bool cancelTimer(TimerWheel *, TimerHandle);
+/* operation:        Removes the entry, so it is never returned by pollExpired().                     */
+/* preconditions:    A initialized wheel.                                                             */
+/* postconditions:   Returns true if it was removed, false if it was already returned or cancelled.   */
+
+// Poll procedure
+int pollExpired(TimerWheel *, uint64_t now, VAL_TYPE * out, int max);
+/* operation:         Moves the clock up to now and copies up to max due values into out, in the order   */
+/*                    they became due.                                                                   */
+/* preconditions:     A initialized wheel. now may not go back in time, an earlier now moves nothing.    */
+/* postconditions:    Returns how many values were copied. The rest stays due: call it again with the    */
+/*                    same now until it returns less than max.                                           */
+
+// Pending entries
+uint64_t getTimerCount(const TimerWheel *);
+/* operation:            Returns how many entries are scheduled and not yet returned or cancelled. */
+/* preconditions:        A initialized wheel.                                                      */
+/* postconditions:       Nothing changes.                                                          */
+
+// Internals, called from the ones above.
+void linkTimerEntry(TimerWheel *, uint32_t e, uint32_t bucket);
+void unlinkTimerEntry(TimerWheel *, uint32_t e);
+void placeTimerEntry(TimerWheel *, uint32_t e, uint64_t from);
+uint64_t getNextWheelTick(const TimerWheel *);
+void runWheelTick(TimerWheel *, uint64_t tick);
+/* operation:        Puts a entry in a bucket and takes it out, all O(1). placeTimerEntry() picks the   */
+/*                   bucket for its deadline as seen from tick from. getNextWheelTick() finds the first */
+/*                   tick after now where some slot must be processed, and runWheelTick() processes it. */
+/* preconditions:    A initialized wheel.                                                               */
+/* postconditions:   Buckets, bitmaps and lists kept in step.                                           */
+
+
+
+/* --- Function actual implementation --- */
+
+// Initializer
+TimerWheel * newTimerWheel(uint64_t now)
+{
+  TimerWheel * w = (TimerWheel *)malloc(sizeof(TimerWheel));
+  if (w == NULL) return w;
+  w->entries = 0;
+  w->entry_count = w->entry_capacity = 0;
+  w->free_list = WHEEL_NONE;
+  for (int b = 0; b < WHEEL_LEVELS * WHEEL_SLOTS; b++) w->buckets[b] = WHEEL_NONE;
+  for (int l = 0; l < WHEEL_LEVELS; l++) w->occupied[l] = 0;
+  w->due_head = w->due_tail = WHEEL_NONE;
+  w->now = now;
+  w->count = 0;
+  return w;
+}
+
+// Finalizer
+void destroyTimerWheel(TimerWheel * w)
+{
+  free(w->entries);
+  free(w);
+}
+
+// Bucket insertion. Slots are unordered, the due list keeps its order.
+void linkTimerEntry(TimerWheel * w, uint32_t e, uint32_t bucket)
+{
+  TimerEntry * entry = &w->entries[e];
+  entry->bucket = bucket;
+  entry->prev = WHEEL_NONE;
+  
+  if (bucket == WHEEL_FREE) {
+    entry->next = w->free_list;
+    w->free_list = e;
+    return;
+  }
+  
+  if (bucket == WHEEL_DUE) {
+    entry->next = WHEEL_NONE;
+    entry->prev = w->due_tail;
+    if (w->due_tail == WHEEL_NONE) w->due_head = e;
+    else w->entries[w->due_tail].next = e;
+    w->due_tail = e;
+    return;
+  }
+  
+  entry->next = w->buckets[bucket];
+  if (entry->next != WHEEL_NONE) w->entries[entry->next].prev = e;
+  w->buckets[bucket] = e;
+  w->occupied[bucket / WHEEL_SLOTS] |= 1ULL << (bucket % WHEEL_SLOTS);
+}
+
+// Bucket removal. Never called on free entries.
+void unlinkTimerEntry(TimerWheel * w, uint32_t e)
+{
+  TimerEntry * entry = &w->entries[e];
+  
+  if (entry->next != WHEEL_NONE) w->entries[entry->next].prev = entry->prev;
+  else if (entry->bucket == WHEEL_DUE) w->due_tail = entry->prev;
+  
+  if (entry->prev != WHEEL_NONE) w->entries[entry->prev].next = entry->next;
+  else if (entry->bucket == WHEEL_DUE) w->due_head = entry->next;
+  else {
+    w->buckets[entry->bucket] = entry->next;
+    if (entry->next == WHEEL_NONE)
+      w->occupied[entry->bucket / WHEEL_SLOTS] &= ~(1ULL << (entry->bucket % WHEEL_SLOTS));
+  }
+}
+
+// Bucket choice.
+void placeTimerEntry(TimerWheel * w, uint32_t e, uint64_t from)
+{
+  uint64_t deadline = w->entries[e].deadline;
+  
+  if (deadline <= from) {
+    linkTimerEntry(w, e, WHEEL_DUE);
+    return;
+  }
+  
+  // The level is the highest WHEEL_BITS group where deadline and from differ. On it, the deadline's slot is
+  // ahead of from's, and on every level above they are the same, so the slot comes up within one turn.
+  uint64_t differ = deadline ^ from;
+  int level = (63 - __builtin_clzll(differ)) / WHEEL_BITS;
+  
+  // Too far for the top level. Park it on the top level's slot 0, which comes up when the whole wheel turns over,
+  // and it is placed again from there with its real deadline.
+  if (level >= WHEEL_LEVELS) {
+    level = WHEEL_LEVELS - 1;
+    deadline = ((from >> (WHEEL_LEVELS * WHEEL_BITS)) + 1) << (WHEEL_LEVELS * WHEEL_BITS);
+  }
+  
+  int slot = (deadline >> (level * WHEEL_BITS)) & (WHEEL_SLOTS - 1);
+  linkTimerEntry(w, e, level * WHEEL_SLOTS + slot);
+}
+
+// Schedule operation
+TimerHandle scheduleTimer(TimerWheel * w, uint64_t deadline, const VAL_TYPE val)
+{
+  uint32_t e = w->free_list;
+  
+  if (e != WHEEL_NONE) {
+    w->free_list = w->entries[e].next;
+  }
+  else {
+    if (w->entry_count == w->entry_capacity) {
+      uint32_t capacity = (w->entry_capacity == 0) ? 64 : w->entry_capacity * 2;
+      if (capacity < w->entry_capacity || capacity == WHEEL_NONE) capacity = WHEEL_NONE - 1;
+      if (capacity == w->entry_capacity) return TIMER_NONE;
+      TimerEntry * entries = (TimerEntry *)realloc(w->entries, (size_t)capacity * sizeof(TimerEntry));
+      if (entries == NULL) return TIMER_NONE;
+      w->entries = entries;
+      w->entry_capacity = capacity;
+    }
+    e = w->entry_count++;
+    w->entries[e].generation = 0;
+  }
+  
+  TimerEntry * entry = &w->entries[e];
+  entry->value = val;
+  entry->deadline = deadline;
+  if (++entry->generation == 0) entry->generation = 1; // Keeps TIMER_NONE out of the handles.
+  placeTimerEntry(w, e, w->now);
+  w->count++;
+  
+  return ((TimerHandle)entry->generation << 32) | e;
+}
+
+// Cancel operation
+bool cancelTimer(TimerWheel * w, TimerHandle handle)
+{
+  uint32_t e = (uint32_t)handle;
+  
+  if (e >= w->entry_count) return false;
+  if (w->entries[e].generation != (uint32_t)(handle >> 32) || w->entries[e].bucket == WHEEL_FREE) return false;
+  
+  unlinkTimerEntry(w, e);
+  linkTimerEntry(w, e, WHEEL_FREE);
+  w->count--;
+  return true;
+}
+
+// Next tick with work.
+uint64_t getNextWheelTick(const TimerWheel * w)
+{
+  uint64_t first = w->now + 1;
+  uint64_t next = UINT64_MAX;
+  
+  for (int l = 0; l < WHEEL_LEVELS; l++)
+  {
+    if (w->occupied[l] == 0) continue;
+    
+    // Level l processes slot s on the ticks whose group l is s and whose lower groups are all zero. Counting in
+    // units of 2^(l * WHEEL_BITS) ticks, find the first such unit at or after first: rotate the bitmap so the
+    // slot of that unit is bit 0, and the lowest set bit is how many units ahead the next one is.
+    int shift = l * WHEEL_BITS;
+    uint64_t unit = (first + (1ULL << shift) - 1) >> shift;
+    int r = unit & (WHEEL_SLOTS - 1);
+    uint64_t rotated = (r == 0) ? w->occupied[l] : (w->occupied[l] >> r) | (w->occupied[l] << (WHEEL_SLOTS - r));
+    uint64_t tick = (unit + __builtin_ctzll(rotated)) << shift;
+    
+    if (tick < next) next = tick;
+  }
+  
+  return next;
+}
+
+// Tick processing.
+void runWheelTick(TimerWheel * w, uint64_t tick)
+{
+  // Top down, since a entry cascading from a level can land on a slot of a lower level due this same tick.
+  for (int l = WHEEL_LEVELS - 1; l >= 0; l--)
+  {
+    int shift = l * WHEEL_BITS;
+    if (shift > 0 && (tick & ((1ULL << shift) - 1)) != 0) continue;
+    
+    uint32_t bucket = l * WHEEL_SLOTS + ((tick >> shift) & (WHEEL_SLOTS - 1));
+    uint32_t e = w->buckets[bucket];
+    w->buckets[bucket] = WHEEL_NONE;
+    w->occupied[l] &= ~(1ULL << (bucket % WHEEL_SLOTS));
+    
+    while (e != WHEEL_NONE)
+    {
+      uint32_t next = w->entries[e].next;
+      placeTimerEntry(w, e, tick);
+      e = next;
+    }
+  }
+}
+
+// Poll operation
+int pollExpired(TimerWheel * w, uint64_t now, VAL_TYPE * out, int max)
+{
+  // Jump from one tick with work to the next, the ones in between have nothing to do.
+  while (w->now < now)
+  {
+    uint64_t tick = getNextWheelTick(w);
+    if (tick > now) {
+      w->now = now;
+      break;
+    }
+    runWheelTick(w, tick);
+    w->now = tick;
+  }
+  
+  int count = 0;
+  while (count < max && w->due_head != WHEEL_NONE)
+  {
+    uint32_t e = w->due_head;
+    out[count++] = w->entries[e].value;
+    unlinkTimerEntry(w, e);
+    linkTimerEntry(w, e, WHEEL_FREE);
+    w->count--;
+  }
+  
+  return count;
+}
+
+// Pending count
+uint64_t getTimerCount(const TimerWheel * w)
+{
+  return w->count;
+}
+
+#endif
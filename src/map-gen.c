@@ -0,0 +1,219 @@
+/* map-gen.c -- generates reproducible grid maps for bfs-bench.c. Same family, size and seed, same map. Always. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Map glyphs. bfs-queue-ex.c only cares about '#', anything else is passable.
+#define MAP_OPEN '.'
+#define MAP_WALL '#'
+
+#define MAP_SIZE_MIN 64
+#define MAP_SIZE_MAX 16384
+
+
+/* --- Usage: ---
+   map-gen <family> <width> <height> <seed> [density] > my.map
+   
+   Families:
+     open      - nothing in the way.
+     random    - each tile is a wall with probability density (0.3 if not given).
+     maze      - perfect maze, exactly one path between any two rooms.
+     corridors - one long corridor snaking from the top row to the bottom one. The seed only moves the turns.
+   
+   The file holds "width height" on the first line, then one line of width glyphs per row. The entrance (0,0)
+   and the exit (width-1,height-1) are always open, but only maze and corridors promise a path between them. */
+
+
+// Random number generator. We bring our own, since rand() is not the same everywhere and maps must be.
+uint64_t nextRandom(uint64_t * state);
+/* operation:          Returns the next 64 bits of a splitmix64 sequence.     */
+/* preconditions:      A state seeded with anything.                          */
+/* postconditions:     state moved forward.                                   */
+/* additional info:    Tiny, fast and good enough for placing walls around.   */
+
+// Map families. All of them fill width * height glyphs, row by row (y * width + x).
+void generateOpen(char * map, int width, int height);
+void generateRandom(char * map, int width, int height, uint64_t * state, double density);
+void generateMaze(char * map, int width, int height, uint64_t * state);
+void generateCorridors(char * map, int width, int height, uint64_t * state);
+/* operation:          Draw one map of the family in map.                                 */
+/* preconditions:      map has room for width * height chars.                            */
+/* postconditions:     The map is drawn, entrance and exit included.                     */
+/* additional info:    See the usage above for what each family looks like.              */
+
+// Write the map out.
+void printMap(FILE *, const char * map, int width, int height);
+/* operation:          Prints the size line and then every row. */
+/* preconditions:      A drawn map.                            */
+/* postconditions:     A map file bfs-bench.c can read.        */
+/* additional info:    */
+
+
+/* --------------------------------------- MAIN --------------------------------------- */
+
+int main(int argc, char * argv[])
+{
+  if (argc < 5) {
+    fprintf(stderr, "Usage: %s <open|random|maze|corridors> <width> <height> <seed> [density]\n", argv[0]);
+    return 1;
+  }
+  
+  const char * family = argv[1];
+  int width = atoi(argv[2]);
+  int height = atoi(argv[3]);
+  uint64_t state = strtoull(argv[4], 0, 10);
+  double density = (argc > 5) ? atof(argv[5]) : 0.3;
+  
+  if (width < MAP_SIZE_MIN || height < MAP_SIZE_MIN || width > MAP_SIZE_MAX || height > MAP_SIZE_MAX) {
+    fprintf(stderr, "Width and height must be between %d and %d.\n", MAP_SIZE_MIN, MAP_SIZE_MAX);
+    return 1;
+  }
+  
+  char * map = (char *)malloc((size_t)width * height);
+  if (map == NULL) {
+    fprintf(stderr, "Not enough memory for a %dx%d map.\n", width, height);
+    return 1;
+  }
+  
+  if (strcmp(family, "open") == 0) generateOpen(map, width, height);
+  else if (strcmp(family, "random") == 0) generateRandom(map, width, height, &state, density);
+  else if (strcmp(family, "maze") == 0) generateMaze(map, width, height, &state);
+  else if (strcmp(family, "corridors") == 0) generateCorridors(map, width, height, &state);
+  else {
+    fprintf(stderr, "Unknown map family: %s\n", family);
+    free(map);
+    return 1;
+  }
+  
+  printMap(stdout, map, width, height);
+  free(map);
+  
+  return 0;
+}
+
+
+
+/* ------------------------------------- FUNTIONS ------------------------------------- */
+
+// splitmix64.
+uint64_t nextRandom(uint64_t * state)
+{
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// Open field.
+void generateOpen(char * map, int width, int height)
+{
+  memset(map, MAP_OPEN, (size_t)width * height);
+}
+
+// Random obstacles.
+void generateRandom(char * map, int width, int height, uint64_t * state, double density)
+{
+  // Compare against a 53 bits threshold, so the density is as exact as a double gets.
+  uint64_t threshold = (uint64_t)(density * (double)(1ULL << 53));
+  
+  for (size_t i = 0; i < (size_t)width * height; i++)
+  {
+    map[i] = ((nextRandom(state) >> 11) < threshold) ? MAP_WALL : MAP_OPEN;
+  }
+  
+  map[0] = MAP_OPEN;
+  map[(size_t)width * height - 1] = MAP_OPEN;
+}
+
+// Perfect maze.
+void generateMaze(char * map, int width, int height, uint64_t * state)
+{
+  // Rooms sit at even x,y and everything else starts as wall. Carving the wall between two rooms links them.
+  int rooms_w = (width + 1) / 2;
+  int rooms_h = (height + 1) / 2;
+  int dx[4] = {0, 1, 0, -1};
+  int dy[4] = {-1, 0, 1, 0};
+  int * stack = (int *)malloc((size_t)rooms_w * rooms_h * sizeof(int));
+  int top = 0;
+  int x, y;
+  
+  memset(map, MAP_WALL, (size_t)width * height);
+  
+  // Randomized depth-first search. An explicit stack, since a 8192x8192 rooms maze would blow the real one.
+  map[0] = MAP_OPEN;
+  stack[top++] = 0;
+  while (top > 0)
+  {
+    int room = stack[top - 1];
+    int rx = room % rooms_w, ry = room / rooms_w;
+    int options[4];
+    int option_count = 0;
+    
+    for (int n = 0; n < 4; n++)
+    {
+      x = rx + dx[n];
+      y = ry + dy[n];
+      if (x >= 0 && y >= 0 && x < rooms_w && y < rooms_h && map[(size_t)(2 * y) * width + 2 * x] == MAP_WALL)
+        options[option_count++] = n;
+    }
+    
+    // Dead end, backtrack.
+    if (option_count == 0) {
+      top--;
+      continue;
+    }
+    
+    int n = options[nextRandom(state) % option_count];
+    map[(size_t)(2 * ry + dy[n]) * width + 2 * rx + dx[n]] = MAP_OPEN;
+    map[(size_t)(2 * (ry + dy[n])) * width + 2 * (rx + dx[n])] = MAP_OPEN;
+    stack[top++] = (ry + dy[n]) * rooms_w + rx + dx[n];
+  }
+  
+  free(stack);
+  
+  // With an even width or height the exit is not a room. Dig from it to the closest one.
+  x = width - 1;
+  y = height - 1;
+  while (x % 2 == 1 || y % 2 == 1)
+  {
+    map[(size_t)y * width + x] = MAP_OPEN;
+    if (x % 2 == 1) x--;
+    else y--;
+  }
+}
+
+// Long corridors.
+void generateCorridors(char * map, int width, int height, uint64_t * state)
+{
+  // Even rows are corridors, odd rows are walls with a single gap, alternating sides, so there is one way through.
+  // The gap moves up to a quarter of the width away from its side, depending on the seed.
+  int gap;
+  
+  for (int y = 0; y < height; y++)
+  {
+    if (y % 2 == 0) {
+      memset(&map[(size_t)y * width], MAP_OPEN, width);
+      continue;
+    }
+    memset(&map[(size_t)y * width], MAP_WALL, width);
+    gap = nextRandom(state) % (width / 4);
+    if ((y / 2) % 2 == 0) gap = width - 1 - gap;
+    map[(size_t)y * width + gap] = MAP_OPEN;
+  }
+  
+  // An even height ends on a wall row, so the exit needs its own gap.
+  map[(size_t)width * height - 1] = MAP_OPEN;
+}
+
+// Map output.
+void printMap(FILE * out, const char * map, int width, int height)
+{
+  fprintf(out, "%d %d\n", width, height);
+  for (int y = 0; y < height; y++)
+  {
+    fwrite(&map[(size_t)y * width], 1, width, out);
+    fputc('\n', out);
+  }
+}
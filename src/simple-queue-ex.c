@@ -20,18 +20,18 @@ int main(void) {
       else printf("Failed on allocate memory.\n");
   }
   
-  printf("\nQueue current has %d elements.\nProceeding to dequeue them.\n\n", q.length);
+  printf("\nQueue current has %lld elements.\nProceeding to dequeue them.\n\n", q.length);
   
   tempLength = q.length;
   for (int j = 0; j < tempLength; j++) {
     printf("Dequeuing node %d... ", j);
     nd = dequeue(&q);
-    printf("Element %d value is %d. Queue has %d remaining elements.\n", j, nd.value, q.length);
+    printf("Element %d value is %d. Queue has %lld remaining elements.\n", j, nd.value, q.length);
   }
   printf("\n");
   
   if (isQueueEmpty(&q)) printf("Queue is empty.\n");
-    else printf("Queue is not empty. Queue has %d elements.\n", q.length);
+    else printf("Queue is not empty. Queue has %lld elements.\n", q.length);
 
   printf("\nDone.\n");
   
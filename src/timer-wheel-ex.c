@@ -0,0 +1,73 @@
+/* timer-wheel-ex.c -- lcfwheel.h holding a million retry deadlines, some of them cancelled, polled tick by tick. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Each entry carries its own deadline, so we can check it fires right on time.
+#define VAL_TYPE uint64_t
+#include "lcfwheel.h"
+
+#define TIMER_COUNT 1000000
+#define HORIZON 100000     // Deadlines go up to this many ticks ahead.
+#define BATCH 256
+
+int main(void) {
+  printf("\nScheduling %d timers up to %d ticks ahead...\n", TIMER_COUNT, HORIZON);
+  
+  TimerWheel * w = newTimerWheel(0);
+  TimerHandle * handles = (TimerHandle *)malloc(TIMER_COUNT * sizeof(TimerHandle));
+  VAL_TYPE due[BATCH];
+  uint64_t seed = 42;
+  uint64_t fired = 0, late = 0, cancelled = 0;
+  double worst = 0, total = 0;
+  int count;
+  
+  for (int i = 0; i < TIMER_COUNT; i++) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint64_t deadline = 1 + (seed >> 33) % HORIZON;
+    handles[i] = scheduleTimer(w, deadline, deadline);
+    if (handles[i] == TIMER_NONE) {
+      printf("Failed on allocate memory.\n");
+      return 1;
+    }
+  }
+  
+  // Every third one gets its answer in time.
+  for (int i = 0; i < TIMER_COUNT; i += 3) {
+    if (cancelTimer(w, handles[i])) cancelled++;
+  }
+  printf("Cancelled %llu of them, %llu still pending.\n", (unsigned long long)cancelled, (unsigned long long)getTimerCount(w));
+  
+  printf("Polling every tick...\n");
+  for (uint64_t now = 1; now <= HORIZON; now++) {
+    struct timespec t0, t1;
+    timespec_get(&t0, TIME_UTC);
+    while ((count = pollExpired(w, now, due, BATCH)) > 0) {
+      for (int i = 0; i < count; i++) {
+        if (due[i] != now) late++;
+      }
+      fired += count;
+      if (count < BATCH) break;
+    }
+    timespec_get(&t1, TIME_UTC);
+    double took = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    if (took > worst) worst = took;
+    total += took;
+  }
+  
+  printf("Fired %llu, %llu of them off their tick. Ticks took %.2f us on average, %.1f us at worst.\n",
+         (unsigned long long)fired, (unsigned long long)late, total / HORIZON * 1e6, worst * 1e6);
+  if (fired + cancelled == TIMER_COUNT && late == 0 && getTimerCount(w) == 0) printf("All timers accounted for.\n");
+    else printf("Some timers went missing!\n");
+  
+  // Cancelling something already fired does nothing.
+  if (!cancelTimer(w, handles[1])) printf("Stale handle ignored.\n");
+  
+  destroyTimerWheel(w);
+  free(handles);
+  
+  printf("\nDone.\n");
+  
+  return 0;
+}